@@ -1,8 +1,40 @@
 #include "foreign_library.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Result of addrproxy_typecheck for all the objects of a given Python type
+enum addrproxy_typecheck
+{
+    TYPECHECK_REJECT,
+    TYPECHECK_ACCEPT,
+    TYPECHECK_IF_CONTIGUOUS, // Address proxy of the same type
+    TYPECHECK_IF_SINGLE, // Array of the pointee type, accepted if of length 1
+};
+
+#define ADDRPROXY_TYPECHECK_CACHE_SIZE 4
+
+// Cached results are keyed by type version tags, that are never reused by
+// another type and change if the type hierarchy is modified
+struct addrproxy_typecheck_entry
+{
+    unsigned int tc_version;
+    enum addrproxy_typecheck tc_result;
+};
 
 typedef struct {
     PyTypeObject tp_base;
     ForeignTypeObject *pointee_type;
+    // Last typecheck results, by Python type of the checked objects
+    struct addrproxy_typecheck_entry ap_typecheck_cache[ADDRPROXY_TYPECHECK_CACHE_SIZE];
+    unsigned ap_typecheck_next; // Next cache entry to replace
+    // Buffer export information, computed on first use
+    char *ap_format; // Format of the innermost elements
+    int ap_ndim; // 1 + number of nested array dimensions inside elements
+    Py_ssize_t *ap_subshape; // Nested array dimensions (ap_ndim - 1 items)
+    Py_ssize_t ap_innersize; // Size of the innermost elements
+    bool ap_readonly; // Whether exported buffers are read-only
 } AddressProxyTypeObject;
 
 static PyObject *addrproxytype_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
@@ -11,6 +43,13 @@ static PyObject *addrproxytype_new(PyTypeObject *type, PyObject *args, PyObject
     return NULL;
 }
 
+static void addrproxytype_dealloc(AddressProxyTypeObject *self)
+{
+    PyMem_Free(self->ap_format);
+    PyMem_Free(self->ap_subshape);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
 PyTypeObject AddressProxy_Metatype = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "allocs.AddressProxyType",
@@ -18,63 +57,125 @@ PyTypeObject AddressProxy_Metatype = {
     .tp_base = &PyType_Type,
     .tp_basicsize = sizeof(AddressProxyTypeObject),
     .tp_new = addrproxytype_new,
+    .tp_dealloc = (destructor) addrproxytype_dealloc,
 };
 
 typedef struct {
     ProxyObject p_base;
     Py_ssize_t ap_length;
+    Py_ssize_t ap_stride; // Distance in bytes between items (negative when reversed)
 } AddressProxyObject;
 
+// Length of proxies whose bounds have not been queried yet
+#define ADDRPROXY_UNKNOWN_LENGTH -1
+
+// Compute the length of the pointed array (= 1 for pointer to single cell)
+static void addrproxy_initlength(AddressProxyObject *self)
+{
+    void *ptr = self->p_base.p_ptr;
+    AddressProxyTypeObject *proxy_type = (AddressProxyTypeObject *) Py_TYPE(self);
+    const struct uniqtype *ptyp = proxy_type->pointee_type->ft_type;
+
+    if (UNIQTYPE_SIZE_IN_BYTES(ptyp) == 0 || !UNIQTYPE_HAS_KNOWN_LENGTH(ptyp))
+    {
+        self->ap_length = 0;
+        return;
+    } 
+
+    unsigned long long start = Query_Begin(QUERY_FETCH_BOUNDS);
+    Bounds bounds = __minicrunch_fetch_bounds(ptr, ptr, ptyp);
+    Query_End(QUERY_FETCH_BOUNDS, start);
+    // If ptr is not the base, it is a single element inside a larger array
+    if (bounds.base == ptr)
+    {
+        unsigned long byte_size = bounds.size;
+        self->ap_length = byte_size / UNIQTYPE_SIZE_IN_BYTES(ptyp);
+    }
+    else self->ap_length = 1;
+}
+
+// Get the length of the pointed array, querying its bounds on first use
 static Py_ssize_t addrproxy_length(AddressProxyObject *self)
 {
+    if (self->ap_length == ADDRPROXY_UNKNOWN_LENGTH)
+    {
+        addrproxy_initlength(self);
+        ++Allocs_GetState()->nb_computed_lengths;
+    }
     return self->ap_length;
 }
 
+PyObject *AddressProxy_LengthStats(void)
+{
+    AllocsState *state = Allocs_GetState();
+    return Py_BuildValue("{sksk}", "deferred", state->nb_deferred_lengths,
+            "computed", state->nb_computed_lengths);
+}
+
+// Check if the items are stored next to each other, in increasing order
+static bool addrproxy_iscontiguous(AddressProxyObject *self)
+{
+    return self->ap_stride == Py_TYPE(self)->tp_itemsize || addrproxy_length(self) <= 1;
+}
+
 static PyObject *addrproxy_item(AddressProxyObject *self, Py_ssize_t index)
 {
-    if (index < 0 || index >= self->ap_length)
+    if (index < 0 || index >= addrproxy_length(self))
     {
         PyErr_SetString(PyExc_IndexError, "address proxy index out of range");
         return NULL;
     }
-    void *item = self->p_base.p_ptr + index * Py_TYPE(self)->tp_itemsize;
+    void *item = self->p_base.p_ptr + index * self->ap_stride;
     ForeignTypeObject *itemtype = ((AddressProxyTypeObject *) Py_TYPE(self))->pointee_type;
     return itemtype->ft_getfrom(item, itemtype);
 }
 
+// Create a view of len items starting at ptr inside the memory of self
+static PyObject *addrproxy_newview(AddressProxyObject *self, void *ptr,
+        Py_ssize_t len, Py_ssize_t stride)
+{
+    // Extend lifetime of the pointed object. The base is looked up from the
+    // memory of self, ptr can be out of bounds for empty views.
+    ProxyObject *base_proxy = Proxy_GetOrCreateBase(self->p_base.p_ptr);
+    if (!base_proxy)
+    {
+        if (!PyErr_Occurred())
+        {
+            PyErr_SetString(PyExc_RuntimeError, "Cannot find the allocation of the sliced memory");
+        }
+        return NULL;
+    }
+
+    AddressProxyObject *viewobj = PyObject_GC_New(AddressProxyObject, Py_TYPE(self));
+    if (viewobj)
+    {
+        Proxy_AddRefTo(base_proxy, (const void **) &viewobj->p_base.p_ptr);
+        viewobj->p_base.p_ptr = ptr;
+        viewobj->ap_length = len;
+        viewobj->ap_stride = stride;
+    }
+    Py_DECREF(base_proxy);
+    return (PyObject *) viewobj;
+}
+
 static PyObject *addrproxy_subscript(AddressProxyObject *self, PyObject *index)
 {
     if (PyLong_Check(index))
     {
         // Single element
         Py_ssize_t i = PyLong_AsSsize_t(index);
-        return addrproxy_item(self, i < 0 ? i + self->ap_length : i);
+        return addrproxy_item(self, i < 0 ? i + addrproxy_length(self) : i);
     }
     else if (PySlice_Check(index))
     {
         Py_ssize_t start, stop, step;
         if (PySlice_Unpack(index, &start, &stop, &step) < 0) return NULL;
-        if (step != 1)
-        {
-            PyErr_SetString(PyExc_IndexError,
-                    "cannot get a slice with custom step on an address proxy");
-            return NULL;
-        }
-        Py_ssize_t len = PySlice_AdjustIndices(self->ap_length, &start, &stop, step);
+        Py_ssize_t len = PySlice_AdjustIndices(addrproxy_length(self), &start, &stop, step);
 
-        AddressProxyObject *sliceobj = PyObject_GC_New(AddressProxyObject, Py_TYPE(self));
-        if (sliceobj)
-        {
-            // Extend lifetime of the pointed object (a base should always already exist)
-            ProxyObject *base_proxy = Proxy_GetOrCreateBase(self->p_base.p_ptr);
-            assert(base_proxy);
-            Proxy_AddRefTo(base_proxy, (const void **) &sliceobj->p_base.p_ptr);
-            Py_DECREF(base_proxy);
-
-            sliceobj->p_base.p_ptr = self->p_base.p_ptr + start * Py_TYPE(self)->tp_itemsize;
-            sliceobj->ap_length = len;
-        }
-        return (PyObject *) sliceobj;
+        // Stepped slices are views sharing the same memory. The start of
+        // empty slices can be out of bounds, keep them at the start of self.
+        void *ptr = len ? self->p_base.p_ptr + start * self->ap_stride : self->p_base.p_ptr;
+        return addrproxy_newview(self, ptr, len, step * self->ap_stride);
     }
     else
     {
@@ -87,12 +188,12 @@ static PyObject *addrproxy_subscript(AddressProxyObject *self, PyObject *index)
 
 static int addrproxy_ass_item(AddressProxyObject *self, Py_ssize_t index, PyObject *value)
 {
-    if (index >= self->ap_length)
+    if (index >= addrproxy_length(self))
     {
         PyErr_SetString(PyExc_IndexError, "address proxy index out of range");
         return -1;
     }
-    void *item = self->p_base.p_ptr + index * Py_TYPE(self)->tp_itemsize;
+    void *item = self->p_base.p_ptr + index * self->ap_stride;
     ForeignTypeObject *itemtype = ((AddressProxyTypeObject *) Py_TYPE(self))->pointee_type;
     return itemtype->ft_storeinto(value, item, itemtype);
 }
@@ -108,9 +209,501 @@ static PySequenceMethods addrproxy_sequencemethods_readonly = {
     .sq_item = (ssizeargfunc) addrproxy_item,
 };
 
+// Compute the buffer format and dimensions of the elements. Arrays of
+// arrays are exposed as a single multi-dimensional buffer.
+static int addrproxytype_initbuffer(AddressProxyTypeObject *type)
+{
+    const struct uniqtype *elemtype = type->pointee_type->ft_type;
+    int ndim = 1;
+    for (const struct uniqtype *t = elemtype;
+            UNIQTYPE_IS_ARRAY_TYPE(t) && UNIQTYPE_HAS_KNOWN_LENGTH(t);
+            t = UNIQTYPE_ARRAY_ELEMENT_TYPE(t))
+    {
+        ++ndim;
+    }
+    if (ndim > PyBUF_MAX_NDIM)
+    {
+        PyErr_SetString(PyExc_BufferError, "Too many nested array dimensions");
+        return -1;
+    }
+
+    Py_ssize_t *subshape = PyMem_Malloc((ndim - 1) * sizeof(Py_ssize_t));
+    if (!subshape)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (int i = 0; i < ndim - 1; ++i)
+    {
+        subshape[i] = UNIQTYPE_ARRAY_LENGTH(elemtype);
+        elemtype = UNIQTYPE_ARRAY_ELEMENT_TYPE(elemtype);
+    }
+
+    char *format = ForeignType_BufferFormat(elemtype);
+    if (!format)
+    {
+        PyMem_Free(subshape);
+        return -1;
+    }
+    type->ap_ndim = ndim;
+    type->ap_subshape = subshape;
+    type->ap_innersize = UNIQTYPE_SIZE_IN_BYTES(elemtype);
+    type->ap_format = format;
+    return 0;
+}
+
+static int addrproxy_getbuffer(AddressProxyObject *self, Py_buffer *view, int flags)
+{
+    AddressProxyTypeObject *type = (AddressProxyTypeObject *) Py_TYPE(self);
+    Py_ssize_t itemsize = type->tp_base.tp_itemsize;
+    Py_ssize_t length = addrproxy_length(self);
+    bool contiguous = addrproxy_iscontiguous(self);
+
+    if (!type->pointee_type || itemsize == 0)
+    {
+        // Expose the raw bytes of the pointed array
+        return PyBuffer_FillInfo(view, (PyObject *) self, self->p_base.p_ptr,
+                length * itemsize, type->ap_readonly, flags);
+    }
+
+    if ((flags & PyBUF_WRITABLE) && type->ap_readonly)
+    {
+        PyErr_SetString(PyExc_BufferError, "Object is not writable.");
+        return -1;
+    }
+    if (!type->ap_format && addrproxytype_initbuffer(type) < 0) return -1;
+
+    int ndim = type->ap_ndim;
+    if (!contiguous && ((flags & PyBUF_STRIDES) != PyBUF_STRIDES ||
+            (flags & ~PyBUF_STRIDES & (PyBUF_C_CONTIGUOUS | PyBUF_F_CONTIGUOUS | PyBUF_ANY_CONTIGUOUS))))
+    {
+        PyErr_SetString(PyExc_BufferError, "Strided address proxy is not contiguous");
+        return -1;
+    }
+    if (ndim > 1 && (flags & PyBUF_ND) != PyBUF_ND)
+    {
+        // Consumers without shape support see contiguous raw bytes
+        return PyBuffer_FillInfo(view, (PyObject *) self, self->p_base.p_ptr,
+                length * itemsize, type->ap_readonly, flags);
+    }
+
+    Py_ssize_t *shape = &self->ap_length;
+    Py_ssize_t *strides = &self->ap_stride;
+    view->internal = NULL;
+    if (ndim > 1)
+    {
+        // Shape and strides are stored together in internal, which is freed
+        // when the buffer is released
+        shape = PyMem_Malloc(2 * ndim * sizeof(Py_ssize_t));
+        if (!shape)
+        {
+            PyErr_NoMemory();
+            return -1;
+        }
+        strides = shape + ndim;
+        shape[0] = length;
+        memcpy(shape + 1, type->ap_subshape, (ndim - 1) * sizeof(Py_ssize_t));
+        strides[ndim-1] = type->ap_innersize;
+        for (int i = ndim - 2; i > 0; --i) strides[i] = strides[i+1] * shape[i+1];
+        strides[0] = self->ap_stride;
+        view->internal = shape;
+    }
+
+    Py_INCREF(self);
+    view->obj = (PyObject *) self;
+    view->buf = self->p_base.p_ptr;
+    view->len = length * itemsize;
+    view->readonly = type->ap_readonly;
+    view->itemsize = type->ap_innersize;
+    view->format = (flags & PyBUF_FORMAT) ? type->ap_format : NULL;
+    view->ndim = ndim;
+    view->shape = (flags & PyBUF_ND) == PyBUF_ND ? shape : NULL;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? strides : NULL;
+    view->suboffsets = NULL;
+    return 0;
+}
+
+static void addrproxy_releasebuffer(AddressProxyObject *self, Py_buffer *view)
+{
+    PyMem_Free(view->internal);
+}
+
+static PyBufferProcs addrproxy_bufferprocs = {
+    .bf_getbuffer = (getbufferproc) addrproxy_getbuffer,
+    .bf_releasebuffer = (releasebufferproc) addrproxy_releasebuffer,
+};
+
+static PyObject *addrproxy_reduce_ex(AddressProxyObject *self, PyObject *protocol)
+{
+    int proto = PyLong_AsLong(protocol);
+    if (proto == -1 && PyErr_Occurred()) return NULL;
+
+    // Pickle the pointed elements as a new array
+    ForeignTypeObject *itemtype = ((AddressProxyTypeObject *) Py_TYPE(self))->pointee_type;
+    const struct uniqtype *arrtype = !itemtype || UNIQTYPE_SIZE_IN_BYTES(itemtype->ft_type) == 0 ? NULL :
+        __liballocs_get_or_create_flexible_array_type((struct uniqtype *) itemtype->ft_type);
+    if (!arrtype)
+    {
+        PyErr_Format(PyExc_TypeError, "Cannot pickle foreign address proxy '%s'",
+                Py_TYPE(self)->tp_name);
+        return NULL;
+    }
+    ForeignTypeObject *arr_ftype = ForeignType_GetOrCreate(arrtype);
+    if (!arr_ftype) return NULL;
+    PyObject *reduced = Proxy_ReduceEx((PyObject *) self, arr_ftype, proto);
+    Py_DECREF(arr_ftype);
+    return reduced;
+}
+
+static PyMethodDef addrproxy_methods[] = {
+    {"__reduce_ex__", (PyCFunction) addrproxy_reduce_ex, METH_O, NULL},
+    {NULL}
+};
+
+// Get the length of the NUL terminated string starting at the proxy. It is
+// bounded by the length of the view if known, else by the allocation bounds,
+// which are not remembered so that reading a string never changes the length
+// of the proxy. Returns -1 with an exception set for strided views and for
+// pointers whose bounds are unknown.
+static Py_ssize_t addrproxy_strlen(AddressProxyObject *self)
+{
+    if (!addrproxy_iscontiguous(self))
+    {
+        PyErr_SetString(PyExc_TypeError, "Strided address proxies are not C strings");
+        return -1;
+    }
+
+    const char *str = self->p_base.p_ptr;
+    if (self->ap_length != ADDRPROXY_UNKNOWN_LENGTH) return strnlen(str, self->ap_length);
+
+    const struct uniqtype *chartype = ((AddressProxyTypeObject *) Py_TYPE(self))->pointee_type->ft_type;
+    unsigned long long start = Query_Begin(QUERY_FETCH_BOUNDS);
+    Bounds bounds = __minicrunch_fetch_bounds(str, str, chartype);
+    Query_End(QUERY_FETCH_BOUNDS, start);
+    unsigned long limit = bounds.base + bounds.size;
+    if (bounds.base > (unsigned long) str || (unsigned long) str >= limit)
+    {
+        PyErr_SetString(PyExc_ValueError, "Cannot find the bounds of the C string, "
+            "slice the pointer to give its maximum length");
+        return -1;
+    }
+    return strnlen(str, limit - (unsigned long) str);
+}
+
+// Characters are always read as a C string, up to the first NUL inside the
+// bounds of the proxy. The whole buffer is available through memoryview.
+static PyObject *addrproxy_bytes(AddressProxyObject *self, PyObject *noargs)
+{
+    Py_ssize_t len = addrproxy_strlen(self);
+    if (len < 0) return NULL;
+    return PyBytes_FromStringAndSize(self->p_base.p_ptr, len);
+}
+
+static PyObject *addrproxy_decode(AddressProxyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = { "encoding", "errors", NULL };
+    const char *encoding = "utf-8", *errors = "strict";
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ss", keywords, &encoding, &errors))
+    {
+        return NULL;
+    }
+
+    Py_ssize_t len = addrproxy_strlen(self);
+    if (len < 0) return NULL;
+    return PyUnicode_Decode(self->p_base.p_ptr, len, encoding, errors);
+}
+
+static PyObject *addrproxy_getcstring(AddressProxyObject *self, void *closure)
+{
+    Py_ssize_t len = addrproxy_strlen(self);
+    if (len < 0) return NULL;
+    PyObject *view = addrproxy_newview(self, self->p_base.p_ptr, len, self->ap_stride);
+    if (!view) return NULL;
+    PyObject *memview = PyMemoryView_FromObject(view);
+    Py_DECREF(view);
+    return memview;
+}
+
+// Additional methods for pointers to chars
+static PyMethodDef addrproxy_str_methods[] = {
+    {"__reduce_ex__", (PyCFunction) addrproxy_reduce_ex, METH_O, NULL},
+    {"__bytes__", (PyCFunction) addrproxy_bytes, METH_NOARGS,
+        "Copy the C string pointed to, without its NUL terminator"},
+    {"decode", (PyCFunction) addrproxy_decode, METH_VARARGS | METH_KEYWORDS,
+        "Decode the C string pointed to, without its NUL terminator"},
+    {NULL}
+};
+
+static PyGetSetDef addrproxy_str_getset[] = {
+    {"cstring", (getter) addrproxy_getcstring, NULL,
+        "Memory view of the C string pointed to, without its NUL terminator", NULL},
+    {NULL}
+};
+
+// Classify a single item buffer format code: 's' for signed integers,
+// 'u' for unsigned integers, 'f' for floats, 'c' for chars and '?' for bools.
+// Returns 0 for formats that cannot be copied without conversion.
+static char buffer_format_kind(const char *format)
+{
+    if (!format) return 'u'; // NULL format means unsigned bytes
+    if (*format == '@' || *format == '=' || *format == (PY_LITTLE_ENDIAN ? '<' : '>'))
+    {
+        ++format;
+    }
+    if (format[0] == '\0' || format[1] != '\0') return 0;
+    switch (format[0])
+    {
+        case 'b': case 'h': case 'i': case 'l': case 'q': case 'n':
+            return 's';
+        case 'B': case 'H': case 'I': case 'L': case 'Q': case 'N':
+            return 'u';
+        case 'f': case 'd': case 'g':
+            return 'f';
+        case 'c':
+        case '?':
+            return format[0];
+        default:
+            return 0;
+    }
+}
+
+// Copy the contents of a buffer with the same element representation as
+// itemtype into dest. If exact is set, the buffer must contain exactly maxlen
+// items. Returns 1 on success with the number of copied items in *nbcopied,
+// 0 if obj cannot be copied without conversion (no exception set) and -1 on
+// error.
+static int addrproxy_copyfrombuffer(PyObject *obj, void *dest, Py_ssize_t maxlen,
+        bool exact, ForeignTypeObject *itemtype, Py_ssize_t *nbcopied)
+{
+    const struct uniqtype *elemtype = itemtype->ft_type;
+    if (!UNIQTYPE_IS_BASE_TYPE(elemtype) || !PyObject_CheckBuffer(obj)) return 0;
+    const char *elemcode = ForeignBaseType_FormatCode(elemtype, true);
+    if (!elemcode) return 0;
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) < 0)
+    {
+        PyErr_Clear();
+        return 0;
+    }
+
+    int ret = 0;
+    Py_ssize_t itemsize = UNIQTYPE_SIZE_IN_BYTES(elemtype);
+    char srckind = buffer_format_kind(view.format);
+    char destkind = buffer_format_kind(elemcode);
+    // Chars also accept raw bytes
+    bool compatible = view.itemsize == itemsize && srckind &&
+        (srckind == destkind || (destkind == 'c' && srckind != 'f' && srckind != '?'));
+    if (compatible)
+    {
+        Py_ssize_t len = view.len / itemsize;
+        if (exact && len != maxlen)
+        {
+            PyErr_Format(PyExc_ValueError, "Cannot assign %zd items "
+                "to a foreign array of %zd items", len, maxlen);
+            ret = -1;
+        }
+        else if (len > maxlen)
+        {
+            PyErr_Format(PyExc_ValueError, "Sequence given is too long "
+                "to be stored at this address (only %zd items)", maxlen);
+            ret = -1;
+        }
+        else
+        {
+            memmove(dest, view.buf, view.len);
+            *nbcopied = len;
+            ret = 1;
+        }
+    }
+    PyBuffer_Release(&view);
+    return ret;
+}
+
+// Convert and store n Python objects into consecutive items at dest
+static int addrproxy_storeitems(PyObject *const *items, Py_ssize_t n, void *dest,
+        ForeignTypeObject *itemtype, Py_ssize_t itemsize)
+{
+    if (itemtype->ft_storemany) return itemtype->ft_storemany(items, n, dest, itemtype);
+
+    for (Py_ssize_t i = 0 ; i < n ; ++i)
+    {
+        if (itemtype->ft_storeinto(items[i], dest + i * itemsize, itemtype) < 0) return -1;
+    }
+    return 0;
+}
+
+// Function prototypes usually found in liballocs_private.h, or added by the
+// trapptrwrites CIL pass. Here we have none of these available.
+void __notify_ptr_write(const void **dest, const void *val);
+void __notify_copy(void *dest, const void *src, unsigned long n);
+
+// Copy n items between foreign arrays of the same type, possibly strided and
+// overlapping. Pointer writes are notified in bulk for contiguous copies,
+// always from the foreign source.
+static int addrproxy_copyitems(void *dest, Py_ssize_t dstride, const void *src,
+        Py_ssize_t sstride, Py_ssize_t n, ForeignTypeObject *itemtype, Py_ssize_t itemsize)
+{
+    bool notify = ForeignType_ContainsPointers(itemtype);
+    if (n == 0) return 0;
+    if (dstride == itemsize && sstride == itemsize)
+    {
+        if (notify) __notify_copy(dest, src, n * itemsize);
+        memmove(dest, src, n * itemsize);
+        return 0;
+    }
+
+    // Gather the source items first if both ranges overlap
+    const void *src_lo = sstride < 0 ? src + (n-1) * sstride : src;
+    const void *dest_lo = dstride < 0 ? dest + (n-1) * dstride : dest;
+    Py_ssize_t src_span = (n-1) * (sstride < 0 ? -sstride : sstride) + itemsize;
+    Py_ssize_t dest_span = (n-1) * (dstride < 0 ? -dstride : dstride) + itemsize;
+    void *tmp = NULL;
+    if (src_lo < dest_lo + dest_span && dest_lo < src_lo + src_span)
+    {
+        tmp = PyMem_Malloc(n * itemsize);
+        if (!tmp)
+        {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    // Notify all the writes while the foreign source items are intact, as
+    // liballocs classifies the pointers by looking at the source
+    for (Py_ssize_t i = 0 ; notify && i < n ; ++i)
+    {
+        __notify_copy(dest + i * dstride, src + i * sstride, itemsize);
+    }
+
+    if (tmp)
+    {
+        for (Py_ssize_t i = 0 ; i < n ; ++i)
+        {
+            memcpy(tmp + i * itemsize, src + i * sstride, itemsize);
+        }
+        src = tmp;
+        sstride = itemsize;
+    }
+
+    for (Py_ssize_t i = 0 ; i < n ; ++i)
+    {
+        memcpy(dest + i * dstride, src + i * sstride, itemsize);
+    }
+    PyMem_Free(tmp);
+    return 0;
+}
+
+// Store the contents of value into n strided items at dest. Value can be an
+// address proxy to the same item type, a buffer or a sequence with exactly n
+// items.
+static int addrproxy_storeslice(PyObject *value, void *dest, Py_ssize_t stride,
+        Py_ssize_t n, ForeignTypeObject *itemtype, Py_ssize_t itemsize)
+{
+    PyTypeObject *valtype = Py_TYPE(value);
+    if (Py_TYPE(valtype) == &AddressProxy_Metatype &&
+            ((AddressProxyTypeObject *) valtype)->pointee_type == itemtype)
+    {
+        AddressProxyObject *src = (AddressProxyObject *) value;
+        if (addrproxy_length(src) != n)
+        {
+            PyErr_Format(PyExc_ValueError, "Cannot assign %zd items "
+                "to a foreign array of %zd items", addrproxy_length(src), n);
+            return -1;
+        }
+        return addrproxy_copyitems(dest, stride, src->p_base.p_ptr, src->ap_stride,
+                n, itemtype, itemsize);
+    }
+
+    if (!ForeignType_IsTriviallyCopiable(itemtype))
+    {
+        PyErr_Format(PyExc_TypeError, "Only arrays of type '%s' can be "
+            "assigned to this foreign array", UNIQTYPE_NAME(itemtype->ft_type));
+        return -1;
+    }
+
+    Py_ssize_t copied_len;
+    if (stride == itemsize)
+    {
+        int copied = addrproxy_copyfrombuffer(value, dest, n, true, itemtype, &copied_len);
+        if (copied) return copied < 0 ? -1 : 0;
+    }
+
+    PyObject *seq = PySequence_Fast(value, "Foreign arrays can only be assigned from sequences");
+    if (!seq) return -1;
+    Py_ssize_t len = PySequence_Fast_GET_SIZE(seq);
+    int ret = 0;
+    if (len != n)
+    {
+        PyErr_Format(PyExc_ValueError, "Cannot assign %zd items "
+            "to a foreign array of %zd items", len, n);
+        ret = -1;
+    }
+    else if (stride == itemsize)
+    {
+        ret = addrproxy_storeitems(PySequence_Fast_ITEMS(seq), n, dest, itemtype, itemsize);
+    }
+    else
+    {
+        for (Py_ssize_t i = 0 ; i < n && ret == 0 ; ++i)
+        {
+            ret = itemtype->ft_storeinto(PySequence_Fast_GET_ITEM(seq, i),
+                    dest + i * stride, itemtype);
+        }
+    }
+    Py_DECREF(seq);
+    return ret;
+}
+
+static int addrproxy_ass_subscript(AddressProxyObject *self, PyObject *index, PyObject *value)
+{
+    ForeignTypeObject *itemtype = ((AddressProxyTypeObject *) Py_TYPE(self))->pointee_type;
+    if (!value)
+    {
+        PyErr_SetString(PyExc_TypeError, "Cannot delete items of an address proxy");
+        return -1;
+    }
+
+    if (PyLong_Check(index))
+    {
+        if (!ForeignType_IsTriviallyCopiable(itemtype))
+        {
+            // Disable silent copy into the array
+            PyErr_Format(PyExc_TypeError, "'%s' object does not support item assignment",
+                    Py_TYPE(self)->tp_name);
+            return -1;
+        }
+        Py_ssize_t i = PyLong_AsSsize_t(index);
+        if (i == -1 && PyErr_Occurred()) return -1;
+        if (i < 0) i += addrproxy_length(self);
+        if (i < 0)
+        {
+            PyErr_SetString(PyExc_IndexError, "address proxy index out of range");
+            return -1;
+        }
+        return addrproxy_ass_item(self, i, value);
+    }
+    else if (PySlice_Check(index))
+    {
+        Py_ssize_t start, stop, step;
+        if (PySlice_Unpack(index, &start, &stop, &step) < 0) return -1;
+        Py_ssize_t len = PySlice_AdjustIndices(addrproxy_length(self), &start, &stop, step);
+        return addrproxy_storeslice(value, self->p_base.p_ptr + start * self->ap_stride,
+                step * self->ap_stride, len, itemtype, Py_TYPE(self)->tp_itemsize);
+    }
+    else
+    {
+        PyErr_Format(PyExc_TypeError,
+                "address proxy indices must be ints or slices, not %s",
+                Py_TYPE(index)->tp_name);
+        return -1;
+    }
+}
+
 static PyMappingMethods addrproxy_mappingmethods = {
     .mp_length = (lenfunc) addrproxy_length,
     .mp_subscript = (binaryfunc) addrproxy_subscript,
+    .mp_ass_subscript = (objobjargproc) addrproxy_ass_subscript,
 };
 
 static int addrproxy_init(AddressProxyObject *self, PyObject *args, PyObject *kwargs)
@@ -123,105 +716,132 @@ static int addrproxy_init(AddressProxyObject *self, PyObject *args, PyObject *kw
         return -1;
     }
 
+    if (!addrproxy_iscontiguous(self))
+    {
+        PyErr_SetString(PyExc_TypeError, "Cannot initialize a strided address proxy");
+        return -1;
+    }
+
     // Default initialization => zero initialize the underlying array
     if (nargs == 0)
     {
-        memset(self->p_base.p_ptr, 0, self->ap_length * Py_TYPE(self)->tp_itemsize);
+        memset(self->p_base.p_ptr, 0, addrproxy_length(self) * Py_TYPE(self)->tp_itemsize);
         return 0;
     }
 
     PyObject *arg = PyTuple_GET_ITEM(args, 0);
-    PyObject *seqarg = PySequence_Fast(arg, "AddressProxyObject.__init__ argument must be a sequence");
-    if (!seqarg) return -1;
-
-    unsigned arglen = PySequence_Fast_GET_SIZE(seqarg);
-    if (arglen > self->ap_length)
-    {
-        PyErr_Format(PyExc_ValueError, "Sequence given is too long "
-            "to be stored at this address (only %d items)", self->ap_length);
-        Py_DECREF(seqarg);
-        return -1;
-    }
-
     ForeignTypeObject *itemtype = ((AddressProxyTypeObject *) Py_TYPE(self))->pointee_type;
-    unsigned itemsize = Py_TYPE(self)->tp_itemsize;
-    for (unsigned i = 0 ; i < arglen ; ++i)
+    Py_ssize_t itemsize = Py_TYPE(self)->tp_itemsize;
+
+    // Buffers holding the exact same representation are copied directly
+    Py_ssize_t arglen;
+    int copied = addrproxy_copyfrombuffer(arg, self->p_base.p_ptr, addrproxy_length(self),
+            false, itemtype, &arglen);
+    if (copied < 0) return -1;
+    if (!copied)
     {
-        PyObject *value = PySequence_Fast_GET_ITEM(seqarg, i);
-        void *item = self->p_base.p_ptr + i * itemsize;
-        if(itemtype->ft_storeinto(value, item, itemtype) < 0)
+        PyObject *seqarg = PySequence_Fast(arg, "AddressProxyObject.__init__ argument must be a sequence");
+        if (!seqarg) return -1;
+
+        arglen = PySequence_Fast_GET_SIZE(seqarg);
+        if (arglen > addrproxy_length(self))
         {
+            PyErr_Format(PyExc_ValueError, "Sequence given is too long "
+                "to be stored at this address (only %zd items)", addrproxy_length(self));
             Py_DECREF(seqarg);
             return -1;
         }
+
+        int storeret = addrproxy_storeitems(PySequence_Fast_ITEMS(seqarg), arglen,
+                self->p_base.p_ptr, itemtype, itemsize);
+        Py_DECREF(seqarg);
+        if (storeret < 0) return -1;
     }
 
     // Zero initialize the rest of the array
-    if (self->ap_length > arglen)
+    if (addrproxy_length(self) > arglen)
     {
         void *first_uninit_item = self->p_base.p_ptr + arglen * itemsize;
-        memset(first_uninit_item, 0, (self->ap_length - arglen) * itemsize);
+        memset(first_uninit_item, 0, (addrproxy_length(self) - arglen) * itemsize);
     }
 
-    Py_DECREF(seqarg);
     return 0;
 }
 
 static PyObject *addrproxy_repr(AddressProxyObject *self)
 {
-    PyObject *repr_acc = PyUnicode_New(0, 0);
-    for (int i = 0; i < self->ap_length; ++i)
+    if (Proxy_ReprTooDeep()) return PyUnicode_FromString("<[...]>");
+
+    _PyUnicodeWriter writer;
+    _PyUnicodeWriter_Init(&writer);
+    writer.overallocate = 1;
+    if (_PyUnicodeWriter_WriteASCIIString(&writer, "<[", 2) < 0) goto error;
+
+    Py_ssize_t length = addrproxy_length(self);
+    for (Py_ssize_t i = 0; i < length; ++i)
     {
+        int truncate = Proxy_ReprTruncate(&writer, i);
+        if (truncate < 0) goto error;
+        if (truncate) break;
+
         PyObject *item_obj = addrproxy_item(self, i);
-        PyObject *item_repr = PyObject_Repr(item_obj);
+        if (!item_obj) goto error;
+        int ret = Proxy_ReprItem(&writer, i, NULL, item_obj);
         Py_DECREF(item_obj);
-        const char* fmt = i == 0 ? "%U%U" : "%U, %U";
-        PyObject *next_repr_acc = PyUnicode_FromFormat(fmt, repr_acc, item_repr);
-        Py_DECREF(repr_acc);
-        Py_DECREF(item_repr);
-        repr_acc = next_repr_acc;
+        if (ret < 0) goto error;
     }
 
-    PyObject *repr = PyUnicode_FromFormat("<[%U]>", repr_acc);
-    Py_DECREF(repr_acc);
-    return repr;
+    if (_PyUnicodeWriter_WriteASCIIString(&writer, "]>", 2) < 0) goto error;
+    return _PyUnicodeWriter_Finish(&writer);
+
+error:
+    _PyUnicodeWriter_Dealloc(&writer);
+    return NULL;
 }
 
 // Special version for native strings
 static PyObject *addrproxy_str_repr(AddressProxyObject *self)
 {
-    PyObject *str_repr = PyUnicode_FromStringAndSize(self->p_base.p_ptr, self->ap_length);
+    if (!addrproxy_iscontiguous(self)) return addrproxy_repr(self);
+
+    Py_ssize_t length = addrproxy_length(self);
+    Py_ssize_t max_size = Allocs_GetState()->repr_limits.max_size;
+    bool truncated = max_size >= 0 && length > max_size;
+    if (truncated)
+    {
+        // Do not cut a multi-byte UTF-8 character in the middle
+        const unsigned char *str = self->p_base.p_ptr;
+        Py_ssize_t limit = max_size;
+        length = limit;
+        while (length > 0 && limit - length < 3 && (str[length] & 0xC0) == 0x80) --length;
+        if ((str[length] & 0xC0) == 0x80) length = limit;
+    }
+
+    PyObject *str_repr = PyUnicode_FromStringAndSize(self->p_base.p_ptr, length);
     if (!str_repr)
     {
         PyErr_Clear();
         return addrproxy_repr(self);
     }
-    PyObject *repr = PyUnicode_FromFormat("<'%U'>", str_repr);
+    PyObject *repr = PyUnicode_FromFormat(truncated ? "<'%U'...>" : "<'%U'>", str_repr);
     Py_DECREF(str_repr);
     return repr;
 }
 
-// Compute the length of the pointed array (= 1 for pointer to single cell)
-static void addrproxy_initlength(AddressProxyObject *self, ForeignTypeObject *type)
+// Create a new address proxy to ptr, extending the lifetime of base_proxy
+// (if not NULL) while it is alive
+static PyObject *addrproxy_newfrom(void *ptr, ProxyObject *base_proxy,
+        PyTypeObject *proxytype, Py_ssize_t length)
 {
-    void *ptr = self->p_base.p_ptr;
-    AddressProxyTypeObject *proxy_type = (AddressProxyTypeObject *) type->ft_proxy_type;
-    const struct uniqtype *ptyp = proxy_type->pointee_type->ft_type;
-
-    if (UNIQTYPE_SIZE_IN_BYTES(ptyp) == 0 || !UNIQTYPE_HAS_KNOWN_LENGTH(ptyp))
-    {
-        self->ap_length = 0;
-        return;
-    } 
-
-    Bounds bounds = __fetch_bounds_internal(ptr, ptr, ptyp);
-    // If ptr is not the base, it is a single element inside a larger array
-    if (bounds.base == ptr)
+    AddressProxyObject *obj = PyObject_GC_New(AddressProxyObject, proxytype);
+    if (obj)
     {
-        unsigned long byte_size = bounds.size;
-        self->ap_length = byte_size / UNIQTYPE_SIZE_IN_BYTES(ptyp);
+        if (base_proxy) Proxy_AddRefTo(base_proxy, (const void **) &obj->p_base.p_ptr);
+        obj->p_base.p_ptr = ptr;
+        obj->ap_stride = proxytype->tp_itemsize;
+        obj->ap_length = length;
     }
-    else self->ap_length = 1;
+    return (PyObject *) obj;
 }
 
 static PyObject *addrproxy_getfrom(void *data, ForeignTypeObject *type)
@@ -258,81 +878,235 @@ static PyObject *addrproxy_getfrom(void *data, ForeignTypeObject *type)
         }
     }
 
-    AddressProxyObject *obj = PyObject_GC_New(AddressProxyObject, type->ft_proxy_type);
-    if (obj)
+    // Bounds are only queried if the proxy is used as an array
+    PyObject *obj = addrproxy_newfrom(ptr, base_proxy, type->ft_proxy_type,
+            ADDRPROXY_UNKNOWN_LENGTH);
+    Py_XDECREF(base_proxy);
+    if (obj) ++Allocs_GetState()->nb_deferred_lengths;
+    return obj;
+}
+
+// Clamp a length read from foreign memory to the number of items of the
+// array of the given type at ptr, so that a garbage count never lets us read
+// past the array. Arrays of known length need no bounds query.
+static Py_ssize_t addrproxy_clamplength(void *ptr, ForeignTypeObject *type, Py_ssize_t length)
+{
+    if (UNIQTYPE_IS_ARRAY_TYPE(type->ft_type) && UNIQTYPE_HAS_KNOWN_LENGTH(type->ft_type))
     {
-        // Extend lifetime of the pointed object
-        if (base_proxy)
-        {
-            Proxy_AddRefTo(base_proxy, (const void **) &obj->p_base.p_ptr);
-            Py_DECREF(base_proxy);
-        }
+        Py_ssize_t array_length = UNIQTYPE_ARRAY_LENGTH(type->ft_type);
+        return length < array_length ? length : array_length;
+    }
 
-        obj->p_base.p_ptr = ptr;
-        addrproxy_initlength(obj, type);
+    const struct uniqtype *ptyp =
+        ((AddressProxyTypeObject *) type->ft_proxy_type)->pointee_type->ft_type;
+    if (length <= 1 || UNIQTYPE_SIZE_IN_BYTES(ptyp) == 0 || !UNIQTYPE_HAS_KNOWN_LENGTH(ptyp))
+    {
+        return length < 1 ? length : 1;
     }
-    return (PyObject *) obj;
-}
 
-// Function prototype usually found in liballocs_private.h, or added by the
-// trapptrwrites CIL pass. Here we have none of these available.
-void __notify_ptr_write(const void **dest, const void *val);
+    unsigned long long start = Query_Begin(QUERY_FETCH_BOUNDS);
+    Bounds bounds = __minicrunch_fetch_bounds(ptr, ptr, ptyp);
+    Query_End(QUERY_FETCH_BOUNDS, start);
+    unsigned long limit = bounds.base + bounds.size;
+    // Without bounds only the pointed item is known to exist
+    Py_ssize_t max_length = 1;
+    if (bounds.base <= (unsigned long) ptr && (unsigned long) ptr < limit)
+    {
+        max_length = (limit - (unsigned long) ptr) / UNIQTYPE_SIZE_IN_BYTES(ptyp);
+    }
+    return length < max_length ? length : max_length;
+}
 
-static bool addrproxy_typecheck(PyObject *obj, ForeignTypeObject *type)
+// Get a proxy for the array or the pointer of the given type stored at data,
+// when the number of items is already known (e.g. from a sibling field).
+// The length is only checked against the bounds of the array.
+PyObject *AddressProxy_GetFromWithLength(void *data, ForeignTypeObject *type, Py_ssize_t length)
 {
-    AddressProxyTypeObject *proxy_type = (AddressProxyTypeObject *) type->ft_proxy_type;
+    void *ptr = data;
+    if (!UNIQTYPE_IS_ARRAY_TYPE(type->ft_type))
+    {
+        ptr = *(void **) data;
+        if (!ptr) Py_RETURN_NONE;
+    }
+    length = addrproxy_clamplength(ptr, type, length);
+
+    ProxyObject *base_proxy = Proxy_GetOrCreateBase(ptr);
+    PyObject *obj = addrproxy_newfrom(ptr, base_proxy, type->ft_proxy_type, length);
+    Py_XDECREF(base_proxy);
+    return obj;
+}
 
+static enum addrproxy_typecheck addrproxy_classify(PyTypeObject *objtype,
+        AddressProxyTypeObject *proxy_type)
+{
     // Check if obj is an address proxy object with the exact same pointee type
-    if (PyObject_TypeCheck(obj, (PyTypeObject *) proxy_type)) return true;
+    // Strided views cannot be seen as plain pointers
+    if (PyType_IsSubtype(objtype, (PyTypeObject *) proxy_type)) return TYPECHECK_IF_CONTIGUOUS;
+
+    // We are a pointer to void: accept anything under a proxy
+    bool void_ptr = proxy_type->pointee_type->ft_type == &__uniqtype__void;
+    if (void_ptr && PyType_IsSubtype(objtype, &Proxy_Type)) return TYPECHECK_ACCEPT;
 
     // Check if obj is a proxy to the pointee type (or a "parent" object of it)
     PyTypeObject *pointee_proxy = proxy_type->pointee_type->ft_proxy_type;
-    if (pointee_proxy && PyObject_TypeCheck(obj, pointee_proxy))
+    if (pointee_proxy && PyType_IsSubtype(objtype, pointee_proxy))
     {
         // Accept everything except arrays (arrays with exact same type are
         // accepted by the first check).
         // FIXME: What we actually want to check is if the data will be used
         // as a pointer to array, not if the argument itself is an array.
         // But we do not have any clue about this (yet).
-        PyTypeObject *objtyp = Py_TYPE(obj);
-        if (Py_TYPE(objtyp) != &AddressProxy_Metatype) return true;
-        if (((AddressProxyObject *) obj)->ap_length == 1) return true;
+        if (Py_TYPE(objtype) != &AddressProxy_Metatype) return TYPECHECK_ACCEPT;
+        return TYPECHECK_IF_SINGLE;
+    }
+
+    // Else typecheck has failed
+    return TYPECHECK_REJECT;
+}
+
+static bool addrproxy_typecheck(PyObject *obj, ForeignTypeObject *type)
+{
+    AddressProxyTypeObject *proxy_type = (AddressProxyTypeObject *) type->ft_proxy_type;
+    PyTypeObject *objtype = Py_TYPE(obj);
+
+    enum addrproxy_typecheck result;
+    if (PyType_HasFeature(objtype, Py_TPFLAGS_VALID_VERSION_TAG) && objtype->tp_version_tag)
+    {
+        struct addrproxy_typecheck_entry *cache = proxy_type->ap_typecheck_cache;
+        unsigned i = 0;
+        while (i < ADDRPROXY_TYPECHECK_CACHE_SIZE && cache[i].tc_version != objtype->tp_version_tag)
+        {
+            ++i;
+        }
+        if (i < ADDRPROXY_TYPECHECK_CACHE_SIZE) result = cache[i].tc_result;
+        else
+        {
+            result = addrproxy_classify(objtype, proxy_type);
+            i = proxy_type->ap_typecheck_next;
+            cache[i].tc_version = objtype->tp_version_tag;
+            cache[i].tc_result = result;
+            proxy_type->ap_typecheck_next = (i + 1) % ADDRPROXY_TYPECHECK_CACHE_SIZE;
+        }
     }
+    else result = addrproxy_classify(objtype, proxy_type);
 
-    if (proxy_type->pointee_type->ft_type == &__uniqtype__void)
+    switch (result)
     {
-        // We are a pointer to void: accept anything under a proxy
-        if (PyObject_TypeCheck(obj, &Proxy_Type)) return true;
+        case TYPECHECK_ACCEPT:
+            return true;
+        case TYPECHECK_IF_CONTIGUOUS:
+            return addrproxy_iscontiguous((AddressProxyObject *) obj);
+        case TYPECHECK_IF_SINGLE:
+            return addrproxy_length((AddressProxyObject *) obj) == 1;
+        default:
+            return false;
     }
+}
 
-    // Else typecheck has failed
-    return false;
+// Copy a str or bytes object into a new registered char array. Used when
+// strings are stored into foreign memory, where they can outlive any call.
+static PyObject *addrproxy_newstring(PyObject *obj, ForeignTypeObject *type)
+{
+    const struct uniqtype *arrtype = __liballocs_get_or_create_flexible_array_type(
+            (struct uniqtype *) UNIQTYPE_POINTEE_TYPE(type->ft_type));
+    if (!arrtype)
+    {
+        PyErr_SetString(PyExc_TypeError, "Cannot create foreign character array");
+        return NULL;
+    }
+    ForeignTypeObject *arr_ftype = ForeignType_GetOrCreate(arrtype);
+    if (!arr_ftype) return NULL;
+
+    PyObject *bytes = PyUnicode_Check(obj) ? PyUnicode_AsUTF8String(obj) : (Py_INCREF(obj), obj);
+    PyObject *args = bytes ? PyTuple_Pack(1, bytes) : NULL;
+    PyObject *arr = args ? arr_ftype->ft_constructor(args, NULL, arr_ftype) : NULL;
+    Py_XDECREF(args);
+    Py_XDECREF(bytes);
+    Py_DECREF(arr_ftype);
+    return arr;
 }
 
-static int addrproxy_storeinto(PyObject *obj, void *dest, ForeignTypeObject *type)
+// Get the address a Python object is stored as into pointers of the given
+// type. Strings are promoted to new foreign arrays, returned in *keepalive so
+// that they are not collected before the pointer write is notified. Returns 0
+// on success and -1 with a Python exception set on error.
+static int addrproxy_pointervalue(PyObject *obj, ForeignTypeObject *type,
+        void **value, PyObject **keepalive)
 {
+    *keepalive = NULL;
+
     // None -> NULL
     if (obj == Py_None)
     {
-        __notify_ptr_write((const void **) dest, NULL);
-        *(void **) dest = NULL;
+        *value = NULL;
         return 0;
     }
 
+    // Strings stored into char pointers are promoted to foreign allocations
+    if ((PyUnicode_Check(obj) || PyBytes_Check(obj)) && ForeignBaseType_IsCharPointer(type->ft_type))
+    {
+        *keepalive = addrproxy_newstring(obj, type);
+        if (!*keepalive) return -1;
+        obj = *keepalive;
+    }
+
     if (!addrproxy_typecheck(obj, type))
     {
         // TODO: We might want to try to convert the data here but we need to
         // handle stack GC first or things will go horribly wrong.
         PyErr_Format(PyExc_TypeError, "expected reference to object of type %s, got %s",
             UNIQTYPE_NAME(UNIQTYPE_POINTEE_TYPE(type->ft_type)), Py_TYPE(obj)->tp_name);
+        Py_CLEAR(*keepalive);
         return -1;
     }
 
-    __notify_ptr_write((const void **) dest, ((ProxyObject *) obj)->p_ptr);
-    *(void **) dest = ((ProxyObject *) obj)->p_ptr;
+    *value = ((ProxyObject *) obj)->p_ptr;
+    return 0;
+}
+
+static int addrproxy_storeinto(PyObject *obj, void *dest, ForeignTypeObject *type)
+{
+    void *value;
+    PyObject *keepalive;
+    if (addrproxy_pointervalue(obj, type, &value, &keepalive) < 0) return -1;
+
+    __notify_ptr_write((const void **) dest, value);
+    *(void **) dest = value;
+    Py_XDECREF(keepalive);
     return 0;
 }
 
+// Resolve all the pointers first so that nothing is written on error. The
+// values are not in foreign memory, so each write is notified on its own.
+static int addrproxy_storemany(PyObject *const *items, Py_ssize_t n, void *dest,
+        ForeignTypeObject *type)
+{
+    void **values = PyMem_Malloc(n * sizeof(void *));
+    PyObject **keepalives = PyMem_Calloc(n, sizeof(PyObject *));
+    int ret = 0;
+    if (!values || !keepalives)
+    {
+        PyErr_NoMemory();
+        ret = -1;
+    }
+
+    for (Py_ssize_t i = 0 ; i < n && ret == 0 ; ++i)
+    {
+        ret = addrproxy_pointervalue(items[i], type, &values[i], &keepalives[i]);
+    }
+
+    for (Py_ssize_t i = 0 ; ret == 0 && i < n ; ++i)
+    {
+        __notify_ptr_write((const void **) dest + i, values[i]);
+        ((void **) dest)[i] = values[i];
+    }
+
+    for (Py_ssize_t i = 0 ; keepalives && i < n ; ++i) Py_XDECREF(keepalives[i]);
+    PyMem_Free(keepalives);
+    PyMem_Free(values);
+    return ret;
+}
+
 static void *addrproxy_getdataptr(PyObject *obj, ForeignTypeObject *type)
 {
     // None -> NULL
@@ -352,9 +1126,14 @@ static int addrproxy_traverse(AddressProxyObject *self, visitproc visit, void *a
     // Check if the elem type must be traversed
     if (!elem_type->ft_traverse) return 0;
 
-    for (int i = 0 ; i < self->ap_length ; ++i)
+    // Do not query bounds during collections. Items of decoded pointers whose
+    // length was never needed are not reported, which can only keep the
+    // objects they reference alive longer. They are still released on clear.
+    if (self->ap_length == ADDRPROXY_UNKNOWN_LENGTH && visit != Proxy_ClearRef) return 0;
+
+    for (int i = 0 ; i < addrproxy_length(self) ; ++i)
     {
-        void *item = self->p_base.p_ptr + i * Py_TYPE(self)->tp_itemsize;
+        void *item = self->p_base.p_ptr + i * self->ap_stride;
         int vret = elem_type->ft_traverse(item, visit, arg, elem_type);
         if (vret) return vret;
     }
@@ -375,6 +1154,13 @@ ForeignTypeObject *AddressProxy_NewType(const struct uniqtype *type)
         PyObject_GC_NewVar(AddressProxyTypeObject, &AddressProxy_Metatype, 0);
     if (!htype) return NULL;
     htype->pointee_type = NULL; // Will be filled in InitType phase
+    memset(htype->ap_typecheck_cache, 0, sizeof(htype->ap_typecheck_cache));
+    htype->ap_typecheck_next = 0;
+    htype->ap_format = NULL;
+    htype->ap_ndim = 0;
+    htype->ap_subshape = NULL;
+    htype->ap_innersize = 0;
+    htype->ap_readonly = true;
 
     htype->tp_base = (PyTypeObject){
         .ob_base = htype->tp_base.ob_base, // <- Keep the object base
@@ -389,6 +1175,9 @@ ForeignTypeObject *AddressProxy_NewType(const struct uniqtype *type)
         .tp_clear = (inquiry) addrproxy_clear,
         .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
         .tp_as_mapping = &addrproxy_mappingmethods,
+        .tp_as_buffer = &addrproxy_bufferprocs,
+        .tp_methods = ForeignBaseType_IsCharPointer(type) ? addrproxy_str_methods : addrproxy_methods,
+        .tp_getset = ForeignBaseType_IsCharPointer(type) ? addrproxy_str_getset : NULL,
     };
 
     ForeignTypeObject *ftype = PyObject_New(ForeignTypeObject, &ForeignType_Type);
@@ -400,6 +1189,7 @@ ForeignTypeObject *AddressProxy_NewType(const struct uniqtype *type)
         ftype->ft_getfrom = addrproxy_getfrom;
         ftype->ft_copyfrom = addrproxy_getfrom;
         ftype->ft_storeinto = addrproxy_storeinto;
+        ftype->ft_storemany = addrproxy_storemany;
         ftype->ft_getdataptr = addrproxy_getdataptr;
         ftype->ft_traverse = Proxy_TraverseRef;
     }
@@ -424,6 +1214,9 @@ void AddressProxy_InitType(ForeignTypeObject *self, const struct uniqtype *type)
             htype->tp_base.tp_base = pointee_ftype->ft_proxy_type;
         }
 
+        // Writing through buffers bypasses pointer write notifications
+        htype->ap_readonly = ForeignType_ContainsPointers(pointee_ftype);
+
         if (ForeignType_IsTriviallyCopiable(pointee_ftype))
         {
             htype->tp_base.tp_as_sequence = &addrproxy_sequencemethods;
@@ -439,21 +1232,61 @@ void AddressProxy_InitType(ForeignTypeObject *self, const struct uniqtype *type)
     assert(typready == 0);
 }
 
+#define HUGE_PAGE_SIZE (2ul << 20)
+
+// Allocate the storage of a foreign array of size bytes with malloc family
+// functions, so that liballocs keeps tracking it as a heap chunk.
+// When zeroed is set and no particular alignment is needed, calloc lets the
+// OS supply lazily zeroed pages for large arrays instead of touching them all.
+// Over-aligned arrays are zeroed eagerly.
+static void *arrayproxy_alloc(size_t size, size_t align, bool huge_pages, bool zeroed)
+{
+    void *ptr;
+    bool overaligned = align > _Alignof(max_align_t);
+    if (!overaligned) ptr = zeroed ? calloc(1, size ? size : 1) : malloc(size ? size : 1);
+    else if (posix_memalign(&ptr, align, size ? size : 1)) ptr = NULL;
+    if (!ptr) return NULL;
+
+#ifdef MADV_HUGEPAGE
+    if (huge_pages && size >= HUGE_PAGE_SIZE)
+    {
+        // Advise on whole pages inside the allocation. The kernel backs the
+        // huge page aligned ranges among them with huge pages when they are
+        // first touched, calloc leaves them untouched.
+        uintptr_t pagesize = sysconf(_SC_PAGESIZE);
+        uintptr_t begin = ((uintptr_t) ptr + pagesize - 1) & ~(pagesize - 1);
+        uintptr_t end = ((uintptr_t) ptr + size) & ~(pagesize - 1);
+        if (begin < end) madvise((void *) begin, end - begin, MADV_HUGEPAGE);
+    }
+#endif
+
+    // posix_memalign has no zeroing variant and can return reused heap memory,
+    // so over-aligned arrays are cleared eagerly, touching all their pages.
+    // With huge pages, this happens after madvise so that they are huge pages.
+    if (zeroed && overaligned) memset(ptr, 0, size);
+    return ptr;
+}
+
 static PyObject *arrayproxy_ctor(PyObject *args, PyObject *kwargs, ForeignTypeObject *type)
 {
     // There must be exactly one sequence argument used as the array initializer
     // TODO: What about explicitly sized array types ?
     //       It's currently impossible to name them in Python
-
-    unsigned nargs = PyTuple_GET_SIZE(args);
-    if (nargs != 1 || (kwargs && PyDict_Size(kwargs)))
+    static char *keywords[] = { "", "align", "huge_pages", NULL };
+    PyObject *arg;
+    Py_ssize_t align = 0;
+    int huge_pages = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|$np:array", keywords,
+            &arg, &align, &huge_pages))
     {
-        PyErr_SetString(PyExc_TypeError,
-            "Array constructor takes exactly one positional argument");
+        return NULL;
+    }
+    if (align < 0 || (align & (align - 1)))
+    {
+        PyErr_SetString(PyExc_ValueError, "Array alignment must be a power of two");
         return NULL;
     }
 
-    PyObject *arg = PyTuple_GET_ITEM(args, 0);
     Py_ssize_t len = PySequence_Size(arg);
     if (len == -1)
     {
@@ -472,31 +1305,44 @@ static PyObject *arrayproxy_ctor(PyObject *args, PyObject *kwargs, ForeignTypeOb
         }
     }
 
+    Py_ssize_t itemsize = type->ft_proxy_type->tp_itemsize;
+    if (len < 0 || (itemsize && len > PY_SSIZE_T_MAX / itemsize - 1))
+    {
+        PyErr_SetString(PyExc_ValueError, "Invalid foreign array length");
+        return NULL;
+    }
+
+    // Little hack to append a \0 character when copying a string
+    bool is_char = ForeignBaseType_IsChar(UNIQTYPE_ARRAY_ELEMENT_TYPE(type->ft_type));
+    size_t allocsize = (is_char ? len + 1 : len) * itemsize;
+    // Arrays built from a length only are zero initialized at allocation
+    bool zeroed = args == NULL;
+    Proxy_ForeignAllocPressure(allocsize);
+    void *storage = arrayproxy_alloc(allocsize, align, huge_pages, zeroed);
+    if (!storage) return PyErr_NoMemory();
+    if (is_char && !zeroed) memset(storage + len*itemsize, '\0', itemsize);
+
     AddressProxyObject *obj = PyObject_GC_New(AddressProxyObject, type->ft_proxy_type);
-    if (obj)
+    if (!obj)
     {
-        Py_ssize_t itemsize = type->ft_proxy_type->tp_itemsize;
-        if (ForeignBaseType_IsChar(UNIQTYPE_ARRAY_ELEMENT_TYPE(type->ft_type)))
-        {
-            // Little hack to append a \0 character when copying a string
-            obj->p_base.p_ptr = malloc((len + 1) * itemsize);
-            memset(obj->p_base.p_ptr + len*itemsize, '\0', itemsize);
-        }
-        else obj->p_base.p_ptr = malloc(len * itemsize);
-        obj->ap_length = len;
+        free(storage);
+        return NULL;
+    }
 
-        __liballocs_set_alloc_type(obj->p_base.p_ptr,
-            __liballocs_get_or_create_array_type(
-                UNIQTYPE_ARRAY_ELEMENT_TYPE(type->ft_type), len));
+    obj->p_base.p_ptr = storage;
+    obj->ap_length = len;
+    obj->ap_stride = itemsize;
 
-        Proxy_Register((ProxyObject *) obj);
-        __liballocs_detach_manual_dealloc_policy(obj->p_base.p_ptr);
+    __liballocs_set_alloc_type(obj->p_base.p_ptr,
+        __liballocs_get_or_create_array_type(
+            UNIQTYPE_ARRAY_ELEMENT_TYPE(type->ft_type), len));
 
-        if (addrproxy_init(obj, args, kwargs) < 0)
-        {
-            Py_DECREF(obj);
-            return NULL;
-        }
+    Proxy_RegisterOwned((ProxyObject *) obj, allocsize);
+
+    if (!zeroed && addrproxy_init(obj, args, NULL) < 0)
+    {
+        Py_DECREF(obj);
+        return NULL;
     }
     return (PyObject *) obj;
 }
@@ -507,12 +1353,14 @@ static PyObject *arrayproxy_getfrom(void *data, ForeignTypeObject *type)
 
     if(obj)
     {
+        obj->ap_stride = type->ft_proxy_type->tp_itemsize;
+
         // If possible take static length information from type
         if (UNIQTYPE_HAS_KNOWN_LENGTH(type->ft_type))
         {
             obj->ap_length = UNIQTYPE_ARRAY_LENGTH(type->ft_type);
         }
-        else addrproxy_initlength(obj, type);
+        else addrproxy_initlength(obj);
     }
 
     return (PyObject *) obj;
@@ -520,9 +1368,34 @@ static PyObject *arrayproxy_getfrom(void *data, ForeignTypeObject *type)
 
 static int arrayproxy_storeinto(PyObject *obj, void *dest, ForeignTypeObject *type)
 {
-    // TODO: Meaningful array copy
-    PyErr_SetString(PyExc_TypeError, "Cannot copy full arrays (for now)");
-    return -1;
+    if (!UNIQTYPE_HAS_KNOWN_LENGTH(type->ft_type))
+    {
+        PyErr_SetString(PyExc_TypeError, "Cannot copy into arrays of unknown length");
+        return -1;
+    }
+
+    ForeignTypeObject *itemtype = ((AddressProxyTypeObject *) type->ft_proxy_type)->pointee_type;
+    Py_ssize_t itemsize = type->ft_proxy_type->tp_itemsize;
+    Py_ssize_t len = UNIQTYPE_ARRAY_LENGTH(type->ft_type);
+    if (PyObject_TypeCheck(obj, type->ft_proxy_type) || ForeignType_ContainsPointers(itemtype))
+    {
+        return addrproxy_storeslice(obj, dest, itemsize, len, itemtype, itemsize);
+    }
+
+    // Shorter sequences are accepted and zero padded as in array initialization
+    AddressProxyObject fake_proxy = {
+        .p_base = {
+            PyObject_HEAD_INIT(type->ft_proxy_type)
+            .p_ptr = dest
+        },
+        .ap_length = len,
+        .ap_stride = itemsize,
+    };
+    PyObject *args = PyTuple_Pack(1, obj);
+    if (!args) return -1;
+    int ret = addrproxy_init(&fake_proxy, args, NULL);
+    Py_DECREF(args);
+    return ret;
 }
 
 static int arrayproxy_traverse(void *data, visitproc visit, void *arg, ForeignTypeObject *type)
@@ -532,13 +1405,31 @@ static int arrayproxy_traverse(void *data, visitproc visit, void *arg, ForeignTy
         PyObject_HEAD_INIT(type->ft_proxy_type)
         .p_ptr = data
     } };
+    fake_proxy.ap_stride = type->ft_proxy_type->tp_itemsize;
 
     if (UNIQTYPE_HAS_KNOWN_LENGTH(type->ft_type))
     {
         fake_proxy.ap_length = UNIQTYPE_ARRAY_LENGTH(type->ft_type);
     }
-    else addrproxy_initlength(&fake_proxy, type);
+    else addrproxy_initlength(&fake_proxy);
+
+    return addrproxy_traverse(&fake_proxy, visit, arg);
+}
 
+// Traverse the first length items of the array of the given type at data,
+// never going past the bounds of the array
+int ArrayProxy_TraverseWithLength(void *data, Py_ssize_t length, visitproc visit,
+        void *arg, ForeignTypeObject *type)
+{
+    length = addrproxy_clamplength(data, type, length);
+    AddressProxyObject fake_proxy = {
+        .p_base = {
+            PyObject_HEAD_INIT(type->ft_proxy_type)
+            .p_ptr = data
+        },
+        .ap_length = length,
+        .ap_stride = type->ft_proxy_type->tp_itemsize,
+    };
     return addrproxy_traverse(&fake_proxy, visit, arg);
 }
 
@@ -553,6 +1444,7 @@ ForeignTypeObject *ArrayProxy_NewType(const struct uniqtype *type)
         ftype->ft_getfrom = arrayproxy_getfrom;
         ftype->ft_copyfrom = NULL;
         ftype->ft_storeinto = arrayproxy_storeinto;
+        ftype->ft_storemany = NULL;
         ftype->ft_getdataptr = NULL;
         ftype->ft_traverse = arrayproxy_traverse;
     }
@@ -1,47 +1,325 @@
 #include "foreign_library.h"
 #include <liballocs.h>
+#include <dlfcn.h>
 
-static struct PyModuleDef allocsmodule =
+// Foreign bytes allocated by proxies between two forced cycle collections
+#define ALLOCS_DEFAULT_FOREIGN_GC_THRESHOLD (64l << 20)
+
+static PyObject *allocs_type_from_symbol(PyObject *self, PyObject *arg)
 {
-    PyModuleDef_HEAD_INIT,
-    "allocs",   /* name of module */
-    NULL,       /* module documentation, may be NULL */
-    -1,         /* size of per-interpreter state of the module,
-                   or -1 if the module keeps state in global variables. */
-    NULL,
-    NULL,
-    NULL,
-    NULL,
-    NULL
+    const char *symname = PyUnicode_AsUTF8(arg);
+    if (!symname) return NULL;
+
+    const struct uniqtype *type = dlsym(RTLD_DEFAULT, symname);
+    if (!type)
+    {
+        PyErr_Format(PyExc_LookupError, "No loaded foreign type named '%s'", symname);
+        return NULL;
+    }
+    return (PyObject *) ForeignType_GetOrCreate(type);
+}
+
+static PyObject *allocs_length_stats(PyObject *self, PyObject *noargs)
+{
+    return AddressProxy_LengthStats();
+}
+
+static PyObject *allocs_bounds_cache_stats(PyObject *self, PyObject *noargs)
+{
+    struct bounds_cache_stats stats = __minicrunch_bounds_cache_stats();
+    return Py_BuildValue("{sksksk}", "hits", stats.hits, "misses", stats.misses,
+            "invalidations", stats.invalidations);
+}
+
+static PyObject *allocs_flush_bounds_cache(PyObject *self, PyObject *noargs)
+{
+    __minicrunch_bounds_cache_flush();
+    Py_RETURN_NONE;
+}
+
+static PyObject *allocs_check_subobject_index(PyObject *self, PyObject *arg)
+{
+    if (!PyObject_TypeCheck(arg, &ForeignType_Type))
+    {
+        PyErr_SetString(PyExc_TypeError, "Expected a foreign type");
+        return NULL;
+    }
+    unsigned long checked;
+    unsigned long mismatches = __minicrunch_check_subobj_index(((ForeignTypeObject *) arg)->ft_type, &checked);
+    return Py_BuildValue("{sksk}", "checked", checked, "mismatches", mismatches);
+}
+
+static PyObject *allocs_repr_limits(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = { "items", "depth", "size", NULL };
+    struct proxy_repr_limits *current = &Allocs_GetState()->repr_limits;
+    struct proxy_repr_limits limits = *current;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$nnn", keywords,
+            &limits.max_items, &limits.max_depth, &limits.max_size))
+    {
+        return NULL;
+    }
+
+    PyObject *previous = Py_BuildValue("{snsnsn}", "items", current->max_items,
+            "depth", current->max_depth, "size", current->max_size);
+    if (previous) *current = limits;
+    return previous;
+}
+
+static PyObject *allocs_async_workers(PyObject *self, PyObject *args)
+{
+    PyObject *nbworkers = NULL;
+    if (!PyArg_ParseTuple(args, "|O", &nbworkers)) return NULL;
+    return AsyncCall_Workers(nbworkers);
+}
+
+static PyObject *allocs_profile(PyObject *self, PyObject *args)
+{
+    int enable = -1;
+    if (!PyArg_ParseTuple(args, "|p", &enable)) return NULL;
+    return Profile_Set(enable);
+}
+
+static PyObject *allocs_profile_stats(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = { "sort", NULL };
+    const char *sort_key = "name";
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|s", keywords, &sort_key)) return NULL;
+    return Profile_Stats(sort_key);
+}
+
+static PyObject *allocs_profile_reset(PyObject *self, PyObject *noargs)
+{
+    Profile_Reset();
+    Py_RETURN_NONE;
+}
+
+static PyObject *allocs_foreign_memory(PyObject *self, PyObject *noargs)
+{
+    AllocsState *state = Allocs_GetState();
+    return Py_BuildValue("{snsnsnsnsk}",
+            "bytes", state->owned_bytes,
+            "blocks", PyDict_GET_SIZE(state->owned_allocs),
+            "pressure", state->foreign_pressure,
+            "gc_threshold", state->foreign_gc_threshold,
+            "gc_collections", state->foreign_gc_collections);
+}
+
+static PyObject *allocs_foreign_gc_threshold(PyObject *self, PyObject *args)
+{
+    AllocsState *state = Allocs_GetState();
+    Py_ssize_t threshold = state->foreign_gc_threshold;
+    if (!PyArg_ParseTuple(args, "|n", &threshold)) return NULL;
+    if (threshold < 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "Threshold must be positive or 0 to disable");
+        return NULL;
+    }
+
+    PyObject *previous = PyLong_FromSsize_t(state->foreign_gc_threshold);
+    state->foreign_gc_threshold = threshold;
+    return previous;
+}
+
+static PyObject *allocs_query_stats(PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = { "reset", NULL };
+    int reset = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|$p", keywords, &reset)) return NULL;
+    return Query_GetStats(reset);
+}
+
+static PyMethodDef allocs_methods[] = {
+    {"_type_from_symbol", (PyCFunction) allocs_type_from_symbol, METH_O,
+        "Get the foreign type of the given uniqtype symbol. "
+        "Used when unpickling foreign types."},
+    {"_length_stats", (PyCFunction) allocs_length_stats, METH_NOARGS,
+        "Get the number of pointer proxies created with a deferred length "
+        "and the number of those whose bounds were eventually queried."},
+    {"_bounds_cache_stats", (PyCFunction) allocs_bounds_cache_stats, METH_NOARGS,
+        "Get the hit, miss and invalidation counts of the bounds cache. Hits "
+        "still query the allocation, they only save the subobject search."},
+    {"_flush_bounds_cache", (PyCFunction) allocs_flush_bounds_cache, METH_NOARGS,
+        "Forget all cached bounds."},
+    {"_check_subobject_index", (PyCFunction) allocs_check_subobject_index, METH_O,
+        "Compare the bounds found by the subobject index for the given type "
+        "with the subobject walk of liballocs."},
+    {"async_workers", (PyCFunction) allocs_async_workers, METH_VARARGS,
+        "async_workers([n]): get the maximum number of threads running "
+        "foreign calls started with acall, raising it to n if given."},
+    {"repr_limits", (PyCFunction) allocs_repr_limits, METH_VARARGS | METH_KEYWORDS,
+        "Set the maximum number of items, nesting depth and size (in characters) "
+        "shown by the repr of foreign arrays and structures. Negative values "
+        "remove the limit. Returns the previous limits as a dict."},
+    {"profile", (PyCFunction) allocs_profile, METH_VARARGS,
+        "profile([enable]): get whether foreign calls (including acall) and "
+        "closures are profiled in this interpreter, enabling or disabling "
+        "profiling if an argument is given."},
+    {"profile_stats", (PyCFunction) allocs_profile_stats, METH_VARARGS | METH_KEYWORDS,
+        "profile_stats(sort='name'): list the call count, the time spent "
+        "converting arguments, in the callee and converting the result (in ns), "
+        "and the blocks obtained from the Python allocators (py_allocations, "
+        "foreign mallocs are not counted) of each profiled function or closure. "
+        "Can be sorted by any counter, in descending order."},
+    {"profile_reset", (PyCFunction) allocs_profile_reset, METH_NOARGS,
+        "Forget the counters accumulated while profiling."},
+    {"foreign_memory", (PyCFunction) allocs_foreign_memory, METH_NOARGS,
+        "Get the number of bytes and blocks of foreign memory currently owned "
+        "by Python proxies, the bytes allocated since the last collection "
+        "forced by foreign memory pressure, and the number of such collections."},
+    {"foreign_gc_threshold", (PyCFunction) allocs_foreign_gc_threshold, METH_VARARGS,
+        "foreign_gc_threshold([bytes]): get the number of bytes of foreign "
+        "memory allocated by proxies that forces a cycle collection, setting "
+        "it if given (0 disables forced collections). The collection is "
+        "deferred until the interpreter handles its pending calls. Returns "
+        "the previous value."},
+    {"query_stats", (PyCFunction) allocs_query_stats, METH_VARARGS | METH_KEYWORDS,
+        "query_stats(*, reset=False): get the number of liballocs queries of "
+        "each kind, with their total and maximum latency and a log2 latency "
+        "histogram of those run while profiling is enabled. The counters are "
+        "cleared after reading them if reset is set."},
+    {NULL}
 };
 
-PyMODINIT_FUNC PyInit_allocs(void)
+// Incremented when a module state is freed, to invalidate cached states.
+// Shared by all interpreters.
+static _Atomic unsigned long allocs_state_generation = 0;
+static _Thread_local PyInterpreterState *cached_state_interp = NULL;
+static _Thread_local unsigned long cached_state_generation = 0;
+static _Thread_local AllocsState *cached_state = NULL;
+
+// Get the registries of the current interpreter. The allocs module of each
+// interpreter is kept in the interpreter dict so that callbacks coming from
+// liballocs can find it without a module object.
+// Returns NULL if allocs was never imported in the current interpreter, which
+// only callbacks from liballocs can observe.
+AllocsState *Allocs_GetState(void)
 {
-    if (PyType_Ready(&LibraryLoader_Type) < 0) return NULL;
-    if (PyType_Ready(&Proxy_Type) < 0) return NULL;
-    if (PyType_Ready(&ForeignType_Type) < 0) return NULL;
-    if (PyType_Ready(&FunctionProxy_Metatype) < 0) return NULL;
-    if (PyType_Ready(&CompositeProxy_Metatype) < 0) return NULL;
-    if (PyType_Ready(&AddressProxy_Metatype) < 0) return NULL;
+    PyInterpreterState *interp = PyInterpreterState_Get();
+    if (interp == cached_state_interp && cached_state_generation == allocs_state_generation)
+    {
+        return cached_state;
+    }
 
-    Proxy_InitGCPolicy();
+    PyObject *interp_dict = PyInterpreterState_GetDict(interp);
+    PyObject *module = interp_dict ? PyDict_GetItemString(interp_dict, "allocs") : NULL;
+    if (!module) return NULL;
+    cached_state = PyModule_GetState(module);
+    cached_state_interp = interp;
+    cached_state_generation = allocs_state_generation;
+    return cached_state;
+}
 
-    PyObject *m = PyModule_Create(&allocsmodule);
-    if (m == NULL) return NULL;
+static int allocs_traverse(PyObject *m, visitproc visit, void *arg)
+{
+    AllocsState *state = PyModule_GetState(m);
+    Py_VISIT(state->proxy_dict);
+    Py_VISIT(state->proxy_pointing_addr_dict);
+    Py_VISIT(state->type_dict);
+    Py_VISIT(state->async_queues);
+    Py_VISIT(state->get_running_loop);
+    Py_VISIT(state->profile_entries);
+    Py_VISIT(state->owned_allocs);
+    Py_VISIT(state->byref_type);
+    Py_VISIT(state->strresult_type);
+    Py_VISIT(state->foreignglobal_type);
+    Py_VISIT(state->asyncqueue_type);
+    return 0;
+}
+
+static int allocs_clear(PyObject *m)
+{
+    AllocsState *state = PyModule_GetState(m);
+    Py_CLEAR(state->proxy_pointing_addr_dict);
+    Py_CLEAR(state->async_queues);
+    Py_CLEAR(state->get_running_loop);
+    Py_CLEAR(state->profile_entries);
+    Py_CLEAR(state->owned_allocs);
+    Py_CLEAR(state->type_dict);
+    Py_CLEAR(state->proxy_dict);
+    Py_CLEAR(state->byref_type);
+    Py_CLEAR(state->strresult_type);
+    Py_CLEAR(state->foreignglobal_type);
+    Py_CLEAR(state->asyncqueue_type);
+    return 0;
+}
+
+static void allocs_free(void *m)
+{
+    allocs_clear(m);
+    ++allocs_state_generation;
+}
+
+static int allocs_exec(PyObject *m)
+{
+    if (PyType_Ready(&LibraryLoader_Type) < 0) return -1;
+    if (PyType_Ready(&Proxy_Type) < 0) return -1;
+    if (PyType_Ready(&ForeignType_Type) < 0) return -1;
+    if (PyType_Ready(&FunctionProxy_Metatype) < 0) return -1;
+    if (PyType_Ready(&CompositeProxy_Metatype) < 0) return -1;
+    if (PyType_Ready(&AddressProxy_Metatype) < 0) return -1;
+
+    // Proxies are registered by address, so a second allocs module in the
+    // same interpreter would not see the objects of the first one
+    PyObject *interp_dict = PyInterpreterState_GetDict(PyInterpreterState_Get());
+    if (!interp_dict || PyDict_GetItemString(interp_dict, "allocs"))
+    {
+        PyErr_SetString(PyExc_ImportError,
+            "allocs can only be initialized once per interpreter");
+        return -1;
+    }
+
+    AllocsState *state = PyModule_GetState(m);
+    state->proxy_dict = PyDict_New();
+    state->proxy_pointing_addr_dict = PyDict_New();
+    state->type_dict = PyDict_New();
+    state->async_queues = PyDict_New();
+    state->profile_entries = PyDict_New();
+    state->owned_allocs = PyDict_New();
+    if (!state->proxy_dict || !state->proxy_pointing_addr_dict ||
+            !state->type_dict || !state->async_queues || !state->profile_entries ||
+            !state->owned_allocs)
+    {
+        return -1;
+    }
+    state->foreign_gc_threshold = ALLOCS_DEFAULT_FOREIGN_GC_THRESHOLD;
+    state->repr_limits = (struct proxy_repr_limits) {
+        .max_items = 256,
+        .max_depth = 8,
+        .max_size = 1 << 16,
+    };
+
+    // Types without a metatype are created for each interpreter
+#define NEW_TYPE(field, spec) \
+    state->field = (PyTypeObject *) PyType_FromModuleAndSpec(m, &spec, NULL); \
+    if (!state->field) return -1;
+    NEW_TYPE(byref_type, ByRef_TypeSpec);
+    NEW_TYPE(strresult_type, StrResultFunction_TypeSpec);
+    NEW_TYPE(foreignglobal_type, ForeignGlobal_TypeSpec);
+    NEW_TYPE(asyncqueue_type, AsyncQueue_TypeSpec);
+#undef NEW_TYPE
+    if (PyDict_SetItemString(interp_dict, "allocs", m) < 0) return -1;
+
+    Proxy_InitGCPolicy();
 
     Py_INCREF(&LibraryLoader_Type);
     PyModule_AddObject(m, "LibraryLoader", (PyObject *) &LibraryLoader_Type);
+    PyModule_AddObjectRef(m, "ForeignGlobal", (PyObject *) state->foreignglobal_type);
     Py_INCREF(&Proxy_Type);
     PyModule_AddObject(m, "Proxy", (PyObject *) &Proxy_Type);
     Py_INCREF(&ForeignType_Type);
     PyModule_AddObject(m, "ForeignType", (PyObject *) &ForeignType_Type);
     Py_INCREF(&FunctionProxy_Metatype);
     PyModule_AddObject(m, "FunctionProxyType", (PyObject *) &FunctionProxy_Metatype);
+    PyModule_AddObjectRef(m, "StrResultFunction", (PyObject *) state->strresult_type);
+    PyModule_AddObjectRef(m, "ByRef", (PyObject *) state->byref_type);
     Py_INCREF(&CompositeProxy_Metatype);
     PyModule_AddObject(m, "CompositeProxyType", (PyObject *) &CompositeProxy_Metatype);
     Py_INCREF(&AddressProxy_Metatype);
     PyModule_AddObject(m, "AddressProxyType", (PyObject *) &AddressProxy_Metatype);
 
+    PyModule_AddIntConstant(m, "TRACEMALLOC_DOMAIN", ALLOCS_TRACEMALLOC_DOMAIN);
+
     // Add basic C scalar types
 #define ADD_TYPE_WITH_NAME(typname, typ) \
     PyModule_AddObject(m, typname, (PyObject *) ForeignType_GetOrCreate(&__uniqtype__##typ))
@@ -62,5 +340,38 @@ PyMODINIT_FUNC PyInit_allocs(void)
 #undef ADD_TYPE
 #undef ADD_TYPE_WITH_NAME
 
-    return m;
+    return 0;
+}
+
+// Registries, counters and the types without a metatype are per interpreter.
+// LibraryLoader, ForeignType, Proxy and the proxy metatypes are still static
+// types shared by all interpreters, so subinterpreters must share the main GIL.
+// Proxy cannot be a heap type while the proxy types built by the metatypes,
+// which derive from it, are static.
+// Foreign objects must not be shared between interpreters, as each one
+// manages their lifetime.
+static PyModuleDef_Slot allocs_slots[] = {
+    {Py_mod_exec, allocs_exec},
+#ifdef Py_mod_multiple_interpreters
+    {Py_mod_multiple_interpreters, Py_MOD_MULTIPLE_INTERPRETERS_SUPPORTED},
+#endif
+    {0, NULL}
+};
+
+static struct PyModuleDef allocsmodule =
+{
+    PyModuleDef_HEAD_INIT,
+    .m_name = "allocs",
+    .m_doc = NULL,
+    .m_size = sizeof(AllocsState),
+    .m_methods = allocs_methods,
+    .m_slots = allocs_slots,
+    .m_traverse = allocs_traverse,
+    .m_clear = allocs_clear,
+    .m_free = allocs_free,
+};
+
+PyMODINIT_FUNC PyInit_allocs(void)
+{
+    return PyModuleDef_Init(&allocsmodule);
 }
@@ -0,0 +1,413 @@
+#include "foreign_library.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#define ASYNC_DEFAULT_NB_WORKERS 4
+
+// Calls waiting for a worker thread, protected by pool_lock
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_cond = PTHREAD_COND_INITIALIZER;
+static struct async_call *pool_head = NULL;
+static struct async_call *pool_tail = NULL;
+
+// Worker threads are started on demand and never stop (protected by the GIL)
+static unsigned pool_nbworkers = 0;
+static unsigned pool_maxworkers = ASYNC_DEFAULT_NB_WORKERS;
+
+// Completion queue of the calls submitted from one event loop.
+// Workers push finished calls to aq_done and signal aq_eventfd only when the
+// list was empty, so a batch of calls finishing together wakes the loop once.
+typedef struct {
+    PyObject_HEAD
+    PyObject *aq_loop;
+    int aq_eventfd;
+    pthread_mutex_t aq_lock;
+    struct async_call *aq_done; // Protected by aq_lock
+    bool aq_closed; // Loop closed, workers release the calls (protected by aq_lock)
+    Py_ssize_t aq_nbpending; // Submitted calls not completed yet (protected by the GIL)
+} AsyncQueueObject;
+
+static void async_release(struct async_call *call)
+{
+    Py_XDECREF(call->ac_future);
+    Py_XDECREF(call->ac_queue);
+    call->ac_free(call);
+}
+
+// Interpreter of the call run by the current worker thread, if any
+static _Thread_local PyInterpreterState *worker_interp = NULL;
+
+static void *async_worker(void *arg)
+{
+    for (;;)
+    {
+        pthread_mutex_lock(&pool_lock);
+        while (!pool_head) pthread_cond_wait(&pool_cond, &pool_lock);
+        struct async_call *call = pool_head;
+        pool_head = call->ac_next;
+        if (!pool_head) pool_tail = NULL;
+        pthread_mutex_unlock(&pool_lock);
+
+        worker_interp = call->ac_interp;
+        call->ac_run(call);
+
+        AsyncQueueObject *queue = (AsyncQueueObject *) call->ac_queue;
+        pthread_mutex_lock(&queue->aq_lock);
+        bool closed = queue->aq_closed;
+        bool wakeup = !closed && !queue->aq_done;
+        if (!closed)
+        {
+            call->ac_next = queue->aq_done;
+            queue->aq_done = call;
+        }
+        pthread_mutex_unlock(&queue->aq_lock);
+
+        if (closed)
+        {
+            // Nothing drains the queue of a closed loop anymore
+            struct python_entry entry;
+            AsyncCall_EnterPython(&entry);
+            async_release(call);
+            AsyncCall_LeavePython(&entry);
+        }
+        else if (wakeup)
+        {
+            uint64_t one = 1;
+            while (write(queue->aq_eventfd, &one, sizeof(one)) < 0 && errno == EINTR);
+        }
+        worker_interp = NULL;
+    }
+    return NULL;
+}
+
+static int async_startworkers(void)
+{
+    while (pool_nbworkers < pool_maxworkers)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, async_worker, NULL) != 0) break;
+        pthread_detach(thread);
+        ++pool_nbworkers;
+    }
+    if (!pool_nbworkers)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "Cannot start foreign call worker threads");
+        return -1;
+    }
+    return 0;
+}
+
+static void async_complete(struct async_call *call)
+{
+    PyObject *done = PyObject_CallMethod(call->ac_future, "done", NULL);
+    int isdone = done ? PyObject_IsTrue(done) : -1;
+    Py_XDECREF(done);
+
+    // Cancelled futures still wait for their call, but drop its result
+    if (isdone == 0)
+    {
+        PyObject *result = call->ac_complete(call);
+        PyObject *setret;
+        if (result)
+        {
+            setret = PyObject_CallMethod(call->ac_future, "set_result", "O", result);
+            Py_DECREF(result);
+        }
+        else
+        {
+            PyObject *exc_type, *exc, *exc_tb;
+            PyErr_Fetch(&exc_type, &exc, &exc_tb);
+            PyErr_NormalizeException(&exc_type, &exc, &exc_tb);
+            if (exc_tb) PyException_SetTraceback(exc, exc_tb);
+            setret = PyObject_CallMethod(call->ac_future, "set_exception", "O", exc);
+            Py_XDECREF(exc_type);
+            Py_XDECREF(exc);
+            Py_XDECREF(exc_tb);
+        }
+        Py_XDECREF(setret);
+    }
+    if (PyErr_Occurred()) PyErr_WriteUnraisable(call->ac_future);
+    async_release(call);
+}
+
+// Stop watching the eventfd once every submitted call has completed
+static int asyncqueue_detach(AsyncQueueObject *self)
+{
+    PyObject *ret = PyObject_CallMethod(self->aq_loop, "remove_reader", "i", self->aq_eventfd);
+    if (!ret) return -1;
+    Py_DECREF(ret);
+    return PyDict_DelItem(Allocs_GetState()->async_queues, self->aq_loop);
+}
+
+// Forget the queue of a loop that was closed with calls still running. Calls
+// that already completed are released without completing their futures, the
+// others are released by the workers.
+static int asyncqueue_close(AsyncQueueObject *self)
+{
+    pthread_mutex_lock(&self->aq_lock);
+    struct async_call *done = self->aq_done;
+    self->aq_done = NULL;
+    self->aq_closed = true;
+    pthread_mutex_unlock(&self->aq_lock);
+
+    Py_INCREF(self);
+    while (done)
+    {
+        struct async_call *next = done->ac_next;
+        async_release(done);
+        --self->aq_nbpending;
+        done = next;
+    }
+    int ret = PyDict_DelItem(Allocs_GetState()->async_queues, self->aq_loop);
+    Py_DECREF(self);
+    return ret;
+}
+
+// Drop the queues of the loops closed since the last submission
+static int asyncqueue_purgeclosed(void)
+{
+    PyObject *async_queues = Allocs_GetState()->async_queues;
+    PyObject *closed = PyList_New(0);
+    if (!closed) return -1;
+
+    Py_ssize_t pos = 0;
+    PyObject *loop, *queue;
+    while (PyDict_Next(async_queues, &pos, &loop, &queue))
+    {
+        PyObject *isclosed = PyObject_CallMethod(loop, "is_closed", NULL);
+        int res = isclosed ? PyObject_IsTrue(isclosed) : -1;
+        Py_XDECREF(isclosed);
+        if (res < 0 || (res && PyList_Append(closed, queue) < 0))
+        {
+            Py_DECREF(closed);
+            return -1;
+        }
+    }
+
+    int ret = 0;
+    for (Py_ssize_t i = 0; i < PyList_GET_SIZE(closed) && ret == 0; ++i)
+    {
+        ret = asyncqueue_close((AsyncQueueObject *) PyList_GET_ITEM(closed, i));
+    }
+    Py_DECREF(closed);
+    return ret;
+}
+
+static PyObject *asyncqueue_drain(AsyncQueueObject *self, PyObject *noargs)
+{
+    uint64_t count;
+    if (read(self->aq_eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+    {
+        return PyErr_SetFromErrno(PyExc_OSError);
+    }
+
+    pthread_mutex_lock(&self->aq_lock);
+    struct async_call *done = self->aq_done;
+    self->aq_done = NULL;
+    pthread_mutex_unlock(&self->aq_lock);
+
+    // Completed calls are pushed in reverse order
+    struct async_call *ordered = NULL;
+    while (done)
+    {
+        struct async_call *next = done->ac_next;
+        done->ac_next = ordered;
+        ordered = done;
+        done = next;
+    }
+
+    Py_INCREF(self); // Detaching can drop the last reference
+    while (ordered)
+    {
+        struct async_call *next = ordered->ac_next;
+        async_complete(ordered);
+        --self->aq_nbpending;
+        ordered = next;
+    }
+
+    PyObject *ret = Py_None;
+    if (self->aq_nbpending == 0 && asyncqueue_detach(self) < 0) ret = NULL;
+    Py_DECREF(self);
+    Py_XINCREF(ret);
+    return ret;
+}
+
+static void asyncqueue_dealloc(AsyncQueueObject *self)
+{
+    if (self->aq_eventfd >= 0) close(self->aq_eventfd);
+    pthread_mutex_destroy(&self->aq_lock);
+    Py_XDECREF(self->aq_loop);
+    PyTypeObject *type = Py_TYPE(self);
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+static PyMethodDef asyncqueue_methods[] = {
+    {"_drain", (PyCFunction) asyncqueue_drain, METH_NOARGS,
+        "Complete the futures of the foreign calls that have finished."},
+    {NULL}
+};
+
+static PyType_Slot asyncqueue_slots[] = {
+    {Py_tp_doc, "Completion queue of asynchronous foreign calls of an event loop"},
+    {Py_tp_dealloc, asyncqueue_dealloc},
+    {Py_tp_methods, asyncqueue_methods},
+    {0, NULL}
+};
+
+PyType_Spec AsyncQueue_TypeSpec = {
+    .name = "allocs.AsyncQueue",
+    .basicsize = sizeof(AsyncQueueObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = asyncqueue_slots,
+};
+
+// Returns a borrowed reference to the queue of loop, creating it if needed
+static AsyncQueueObject *asyncqueue_forloop(PyObject *loop)
+{
+    PyObject *async_queues = Allocs_GetState()->async_queues;
+    AsyncQueueObject *queue = (AsyncQueueObject *) PyDict_GetItemWithError(async_queues, loop);
+    if (queue || PyErr_Occurred()) return queue;
+
+    queue = PyObject_New(AsyncQueueObject, Allocs_GetState()->asyncqueue_type);
+    if (!queue) return NULL;
+    Py_INCREF(loop);
+    queue->aq_loop = loop;
+    queue->aq_done = NULL;
+    queue->aq_closed = false;
+    queue->aq_nbpending = 0;
+    pthread_mutex_init(&queue->aq_lock, NULL);
+    queue->aq_eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (queue->aq_eventfd < 0)
+    {
+        PyErr_SetFromErrno(PyExc_OSError);
+        Py_DECREF(queue);
+        return NULL;
+    }
+
+    PyObject *drain = PyObject_GetAttrString((PyObject *) queue, "_drain");
+    PyObject *ret = drain ?
+        PyObject_CallMethod(loop, "add_reader", "iO", queue->aq_eventfd, drain) : NULL;
+    Py_XDECREF(drain);
+    if (!ret || PyDict_SetItem(async_queues, loop, (PyObject *) queue) < 0)
+    {
+        Py_XDECREF(ret);
+        Py_DECREF(queue);
+        return NULL;
+    }
+    Py_DECREF(ret);
+    Py_DECREF(queue); // The dictionary keeps it alive
+    return queue;
+}
+
+// Run call on the worker pool and return a future of the running event loop
+// completed with the result of call->ac_complete. Takes ownership of call,
+// which is released with call->ac_free even on error.
+PyObject *AsyncCall_Submit(struct async_call *call)
+{
+    call->ac_next = NULL;
+    call->ac_future = NULL;
+    call->ac_queue = NULL;
+    call->ac_interp = PyInterpreterState_Get();
+    AsyncQueueObject *queue = NULL;
+
+    // Each interpreter has its own asyncio module
+    AllocsState *state = Allocs_GetState();
+    if (!state->get_running_loop)
+    {
+        PyObject *asyncio = PyImport_ImportModule("asyncio");
+        if (asyncio)
+        {
+            state->get_running_loop = PyObject_GetAttrString(asyncio, "get_running_loop");
+            Py_DECREF(asyncio);
+        }
+        if (!state->get_running_loop) goto error;
+    }
+
+    if (asyncqueue_purgeclosed() < 0) goto error;
+    PyObject *loop = PyObject_CallNoArgs(state->get_running_loop);
+    if (!loop) goto error;
+    queue = asyncqueue_forloop(loop);
+    if (queue) call->ac_future = PyObject_CallMethod(loop, "create_future", NULL);
+    Py_DECREF(loop);
+    if (!call->ac_future || async_startworkers() < 0) goto error;
+
+    Py_INCREF(queue);
+    call->ac_queue = (PyObject *) queue;
+    ++queue->aq_nbpending;
+
+    pthread_mutex_lock(&pool_lock);
+    if (pool_tail) pool_tail->ac_next = call;
+    else pool_head = call;
+    pool_tail = call;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_lock);
+
+    Py_INCREF(call->ac_future);
+    return call->ac_future;
+
+error:
+    // Do not leave the reader of a new queue registered without any call
+    if (queue && queue->aq_nbpending == 0)
+    {
+        PyObject *exc_type, *exc, *exc_tb;
+        PyErr_Fetch(&exc_type, &exc, &exc_tb);
+        if (asyncqueue_detach(queue) < 0) PyErr_WriteUnraisable(NULL);
+        PyErr_Restore(exc_type, exc, exc_tb);
+    }
+    async_release(call);
+    return NULL;
+}
+
+// Get the maximum number of worker threads, and raise it to nbworkers if
+// given. Running workers are never stopped.
+PyObject *AsyncCall_Workers(PyObject *nbworkers)
+{
+    unsigned previous = pool_maxworkers;
+    if (nbworkers && nbworkers != Py_None)
+    {
+        long n = PyLong_AsLong(nbworkers);
+        if (n == -1 && PyErr_Occurred()) return NULL;
+        if (n <= 0 || n > 1024)
+        {
+            PyErr_SetString(PyExc_ValueError, "Number of workers must be between 1 and 1024");
+            return NULL;
+        }
+        if (n > pool_maxworkers) pool_maxworkers = n;
+    }
+    return PyLong_FromUnsignedLong(previous);
+}
+
+// Make sure the current thread can run Python code of the right interpreter.
+// Needed when foreign code calls back into Python while it runs on a worker
+// thread. Must be paired with AsyncCall_LeavePython.
+void AsyncCall_EnterPython(struct python_entry *entry)
+{
+    entry->tstate = NULL;
+    entry->ensured = false;
+    if (_PyThreadState_UncheckedGet()) return; // Already running Python code
+
+    if (worker_interp)
+    {
+        entry->tstate = PyThreadState_New(worker_interp);
+        PyEval_RestoreThread(entry->tstate);
+    }
+    else
+    {
+        entry->gilstate = PyGILState_Ensure();
+        entry->ensured = true;
+    }
+}
+
+void AsyncCall_LeavePython(struct python_entry *entry)
+{
+    if (entry->tstate)
+    {
+        PyThreadState_Clear(entry->tstate);
+        PyThreadState_DeleteCurrent();
+    }
+    else if (entry->ensured) PyGILState_Release(entry->gilstate);
+}
@@ -3,11 +3,26 @@
 struct field_info {
     ForeignTypeObject *type;
     size_t offset;
+    // Sibling integer field holding the number of items of this array or
+    // pointer field, or NULL if the length must be found from the bounds
+    struct field_info *length_field;
+};
+
+// One step of the precomputed initialization plan of a composite type.
+// There is one step for each field with a recognized foreign type.
+struct init_step {
+    struct field_info *field_info;
+    PyObject *name; // Interned field name, used for dict and attribute lookups
+    unsigned index; // Index of the field, i.e. of the matching positional argument
 };
 
 typedef struct {
     PyTypeObject tp_base;
+    const struct uniqtype *fct_type;
     struct field_info *fct_fieldinfos;
+    struct init_step *fct_initplan;
+    unsigned fct_nbinitsteps;
+    bool fct_haspointers; // Whether the composite holds pointers, even nested
 } CompositeProxyTypeObject;
 
 static PyObject *compositeproxytype_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
@@ -22,8 +37,13 @@ static void compositeproxytype_dealloc(CompositeProxyTypeObject *self)
     {
         Py_XDECREF(self->fct_fieldinfos[i].type);
     }
+    for (unsigned i = 0; i < self->fct_nbinitsteps ; ++i)
+    {
+        Py_XDECREF(self->fct_initplan[i].name);
+    }
     PyMem_Free(self->tp_base.tp_getset);
     PyMem_Free(self->fct_fieldinfos);
+    PyMem_Free(self->fct_initplan);
     Py_TYPE(self)->tp_free((PyObject *) self);
 }
 
@@ -43,23 +63,42 @@ static PyObject *compositeproxy_getinvalidfield(PyObject *self, void *cb)
     return NULL;
 }
 
+static Py_ssize_t compositeproxy_boundlength(void *data, struct field_info *field_info)
+{
+    struct field_info *length_info = field_info->length_field;
+    return ForeignBaseType_ReadLength(data + length_info->offset, length_info->type->ft_type);
+}
+
 static PyObject *compositeproxy_getfield(ProxyObject *self, struct field_info *field_info)
 {
     void *field = self->p_ptr + field_info->offset;
     ForeignTypeObject *ftype = field_info->type;
+    if (field_info->length_field)
+    {
+        return AddressProxy_GetFromWithLength(field, ftype,
+                compositeproxy_boundlength(self->p_ptr, field_info));
+    }
     return ftype->ft_getfrom(field, ftype);
 }
 
-static int compositeproxy_setfield(ProxyObject *self, PyObject *value, struct field_info *field_info)
+static int compositeproxy_storefield(void *data, PyObject *value, struct field_info *field_info)
 {
-    void *field = self->p_ptr + field_info->offset;
+    void *field = data + field_info->offset;
     ForeignTypeObject *ftype = field_info->type;
     return ftype->ft_storeinto(value, field, ftype);
 }
 
-static int compositeproxy_init(ProxyObject *self, PyObject *args, PyObject *kwargs)
+static int compositeproxy_setfield(ProxyObject *self, PyObject *value, struct field_info *field_info)
 {
-    PyTypeObject *type = Py_TYPE(self);
+    return compositeproxy_storefield(self->p_ptr, value, field_info);
+}
+
+// Initialize the composite of the given proxy type at data from constructor
+// arguments, or from a single object if args is not a tuple and kwargs NULL.
+// data does not need to belong to a proxy.
+static int compositeproxy_initdata(void *data, PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    CompositeProxyTypeObject *ctype = (CompositeProxyTypeObject *) type;
 
     bool convert_mode = !PyTuple_Check(args) && kwargs == NULL;
     unsigned nargs = convert_mode ? 1 : PyTuple_GET_SIZE(args);
@@ -68,7 +107,7 @@ static int compositeproxy_init(ProxyObject *self, PyObject *args, PyObject *kwar
     // Default initialization => zero initialize the whole structure
     if (nargs == 0 && nkwargs == 0)
     {
-        memset(self->p_ptr, 0, type->tp_itemsize);
+        memset(data, 0, type->tp_itemsize);
         return 0;
     }
 
@@ -81,13 +120,13 @@ static int compositeproxy_init(ProxyObject *self, PyObject *args, PyObject *kwar
             ProxyObject *other = (ProxyObject *) arg;
 
             // Checking pointer equality is enough for checking aliasing
-            if (self->p_ptr == other->p_ptr)
+            if (data == other->p_ptr)
             {
                 PyErr_SetString(PyExc_ValueError, "Trying to copy inside yourself");
                 return -1;
             }
 
-            memcpy(self->p_ptr, other->p_ptr, type->tp_itemsize);
+            memcpy(data, other->p_ptr, type->tp_itemsize);
             return 0;
         }
 
@@ -102,12 +141,15 @@ static int compositeproxy_init(ProxyObject *self, PyObject *args, PyObject *kwar
         {
             // Try to initialize from a plain object using attributes for all
             // fields. All attributes must match, or we fail.
+            memset(data, 0, type->tp_itemsize);
             bool objinit_success = true;
-            for (unsigned i = 0 ; type->tp_getset[i].name ; ++i)
+            for (unsigned i = 0 ; i < ctype->fct_nbinitsteps ; ++i)
             {
-                PyObject *field = PyObject_GetAttrString(arg, type->tp_getset[i].name);
-                if (!field || compositeproxy_setfield(self, field,
-                            type->tp_getset[i].closure) < 0)
+                struct init_step *step = &ctype->fct_initplan[i];
+                PyObject *field = PyObject_GetAttr(arg, step->name);
+                int setret = field ? compositeproxy_storefield(data, field, step->field_info) : -1;
+                Py_XDECREF(field);
+                if (setret < 0)
                 {
                     PyErr_Clear();
                     objinit_success = false;
@@ -127,38 +169,32 @@ static int compositeproxy_init(ProxyObject *self, PyObject *args, PyObject *kwar
         return -1;
     }
 
-    // Else we initialize fields in order or by taking a keyword argument
+    // Else we initialize fields in order or by taking a keyword argument.
+    // Fields without initialization data are zero initialized, so clear
+    // everything at once before running the plan.
+    memset(data, 0, type->tp_itemsize);
     unsigned initialized_fields = 0;
-    for (unsigned i = 0 ; type->tp_getset[i].name ; ++i)
+    for (unsigned i = 0 ; i < ctype->fct_nbinitsteps ; ++i)
     {
-        // No initialization for unrecognized types
-        if (type->tp_getset[i].get != (getter) compositeproxy_getfield) continue;
+        struct init_step *step = &ctype->fct_initplan[i];
 
         // Direct call to setfield to also copy nested structs
-        if (i < nargs) // Use positional arguments first
-        {
-            PyObject *value = PyTuple_GET_ITEM(args, i);
-            if (compositeproxy_setfield(self, value, type->tp_getset[i].closure) < 0)
-                return -1;
-            ++initialized_fields;
-        }
-        else
+        PyObject *value;
+        if (step->index < nargs) value = PyTuple_GET_ITEM(args, step->index);
+        else if (kwargs)
         {
-            PyObject *arg = kwargs ? PyDict_GetItemString(kwargs, type->tp_getset[i].name) : NULL;
-            if (arg)
+            value = PyDict_GetItemWithError(kwargs, step->name);
+            if (!value)
             {
-                if (compositeproxy_setfield(self, arg, type->tp_getset[i].closure) < 0)
-                    return -1;
-                ++initialized_fields;
-            }
-            else
-            {
-                // No initialization data for the field => zero initialization
-                struct field_info *field_info = type->tp_getset[i].closure;
-                void *field = self->p_ptr + field_info->offset;
-                memset(field, 0, UNIQTYPE_SIZE_IN_BYTES(field_info->type->ft_type));
+                if (PyErr_Occurred()) return -1;
+                continue;
             }
         }
+        else break; // Steps are sorted by index, nothing more to initialize
+
+        if (compositeproxy_storefield(data, value, step->field_info) < 0)
+            return -1;
+        ++initialized_fields;
     }
 
     if (initialized_fields <= nargs + nkwargs) return 0;
@@ -176,15 +212,45 @@ static int compositeproxy_init(ProxyObject *self, PyObject *args, PyObject *kwar
     }
 }
 
+static int compositeproxy_init(ProxyObject *self, PyObject *args, PyObject *kwargs)
+{
+    return compositeproxy_initdata(self->p_ptr, Py_TYPE(self), args, kwargs);
+}
+
+// Structures up to this size are converted on the stack by
+// compositeproxy_storeinto
+#define COMPOSITE_STACK_CONVERT_MAX 1024
+
+// Convert tuples, dicts and plain objects directly into dest, without
+// creating a temporary proxy. Only possible when the composite holds no
+// pointer, as pointer stores register dest as a referencing location.
+// The conversion is done on the stack first so that dest is left untouched
+// on failure.
+static int compositeproxy_storeinto(PyObject *obj, void *dest, ForeignTypeObject *type)
+{
+    PyTypeObject *proxy_type = type->ft_proxy_type;
+    Py_ssize_t size = proxy_type->tp_itemsize;
+    if (PyObject_TypeCheck(obj, proxy_type) || size > COMPOSITE_STACK_CONVERT_MAX ||
+            ((CompositeProxyTypeObject *) proxy_type)->fct_haspointers)
+    {
+        return Proxy_StoreInto(obj, dest, type);
+    }
+
+    _Alignas(max_align_t) char converted[COMPOSITE_STACK_CONVERT_MAX];
+    if (compositeproxy_initdata(converted, proxy_type, obj, NULL) < 0) return -1;
+    memcpy(dest, converted, size);
+    return 0;
+}
+
 static PyObject *compositeproxy_ctor(PyObject *args, PyObject *kwds, ForeignTypeObject *type)
 {
     ProxyObject *obj = PyObject_GC_New(ProxyObject, type->ft_proxy_type);
     if (obj)
     {
+        Proxy_ForeignAllocPressure(type->ft_proxy_type->tp_itemsize);
         obj->p_ptr = malloc(type->ft_proxy_type->tp_itemsize);
         __liballocs_set_alloc_type(obj->p_ptr, type->ft_type);
-        Proxy_Register(obj);
-        __liballocs_detach_manual_dealloc_policy(obj->p_ptr);
+        Proxy_RegisterOwned(obj, type->ft_proxy_type->tp_itemsize);
         // Note that because the Python GC policy has been attached obj->p_ptr
         // is never freed at this point
         if (compositeproxy_init(obj, args, kwds) < 0)
@@ -200,40 +266,79 @@ static PyObject *compositeproxy_repr(ProxyObject *self)
 {
     PyTypeObject *type = Py_TYPE(self);
 
+    if (Proxy_ReprTooDeep()) return PyUnicode_FromFormat("(%s){...}", type->tp_name);
+
     // Break repr cycles: do not print a nested struct with an already seen type
     int rec = Py_ReprEnter((PyObject *) type);
     if (rec < 0) return NULL;
     if (rec > 0) return PyUnicode_FromFormat("(%s){...}", type->tp_name);
 
-    PyObject *field_repr_list = PyList_New(0);
+    _PyUnicodeWriter writer;
+    _PyUnicodeWriter_Init(&writer);
+    writer.overallocate = 1;
+    if (_PyUnicodeWriter_WriteChar(&writer, '(') < 0) goto error;
+    if (_PyUnicodeWriter_WriteASCIIString(&writer, type->tp_name, -1) < 0) goto error;
+    if (_PyUnicodeWriter_WriteASCIIString(&writer, "){", 2) < 0) goto error;
+
+    Py_ssize_t nbfields = 0;
     for (int i = 0 ; type->tp_getset[i].name ; ++i)
     {
         // Skip unrecognized types. TODO: Maybe show them...
         if (type->tp_getset[i].get != (getter) compositeproxy_getfield) continue;
 
+        int truncate = Proxy_ReprTruncate(&writer, nbfields);
+        if (truncate < 0) goto error;
+        if (truncate) break;
+
         PyObject *field_obj = compositeproxy_getfield(self, type->tp_getset[i].closure);
-        PyObject *field_val_repr = PyObject_Repr(field_obj);
+        if (!field_obj) goto error;
+        int ret = Proxy_ReprItem(&writer, nbfields++, type->tp_getset[i].name, field_obj);
         Py_DECREF(field_obj);
-        if (!field_val_repr)
-        {
-            Py_DECREF(field_repr_list);
-            return NULL;
-        }
-        PyObject *field_repr = PyUnicode_FromFormat("%s: %U", type->tp_getset[i].name, field_val_repr);
-        Py_DECREF(field_val_repr);
-        PyList_Append(field_repr_list, field_repr);
-        Py_DECREF(field_repr);
+        if (ret < 0) goto error;
     }
-    PyObject *sep = PyUnicode_FromString(", ");
-    PyObject *fields_str = PyUnicode_Join(sep, field_repr_list);
-    Py_DECREF(sep);
-    Py_DECREF(field_repr_list);
-    PyObject *repr = PyUnicode_FromFormat("(%s){%U}", type->tp_name, fields_str);
-    Py_DECREF(fields_str);
+
+    if (_PyUnicodeWriter_WriteChar(&writer, '}') < 0) goto error;
+    Py_ReprLeave((PyObject *) type);
+    return _PyUnicodeWriter_Finish(&writer);
+
+error:
+    _PyUnicodeWriter_Dealloc(&writer);
     Py_ReprLeave((PyObject *) type);
-    return repr;
+    return NULL;
+}
+
+static int compositeproxy_getbuffer(ProxyObject *self, Py_buffer *view, int flags)
+{
+    // Expose the raw bytes of the structure. Writing pointers through the
+    // buffer would bypass the lifetime bookkeeping, so structures holding
+    // pointers are read-only (PyBuffer_FillInfo rejects writable requests).
+    CompositeProxyTypeObject *type = (CompositeProxyTypeObject *) Py_TYPE(self);
+    return PyBuffer_FillInfo(view, (PyObject *) self, self->p_ptr,
+            type->tp_base.tp_itemsize, type->fct_haspointers, flags);
+}
+
+static PyBufferProcs compositeproxy_bufferprocs = {
+    .bf_getbuffer = (getbufferproc) compositeproxy_getbuffer,
+};
+
+static PyObject *compositeproxy_reduce_ex(ProxyObject *self, PyObject *protocol)
+{
+    int proto = PyLong_AsLong(protocol);
+    if (proto == -1 && PyErr_Occurred()) return NULL;
+
+    CompositeProxyTypeObject *type = (CompositeProxyTypeObject *) Py_TYPE(self);
+    ForeignTypeObject *ftype = ForeignType_GetOrCreate(type->fct_type);
+    if (!ftype) return NULL;
+    PyObject *reduced = Proxy_ReduceEx((PyObject *) self, ftype, proto);
+    Py_DECREF(ftype);
+    return reduced;
 }
 
+static PyMethodDef compositeproxy_methods[] = {
+    {"__reduce_ex__", (PyCFunction) compositeproxy_reduce_ex, METH_O, NULL},
+    {NULL}
+};
+
 static int compositeproxy_traverse(void *data, PyTypeObject *type, visitproc visit, void *arg)
 {
     for (int i_field = 0 ; type->tp_getset[i_field].name ; ++i_field)
@@ -241,8 +346,18 @@ static int compositeproxy_traverse(void *data, PyTypeObject *type, visitproc vis
         struct field_info *field_info = type->tp_getset[i_field].closure;
         if (field_info->type && field_info->type->ft_traverse)
         {
-            int vret = field_info->type->ft_traverse(data + field_info->offset,
-                    visit, arg, field_info->type);
+            int vret;
+            if (field_info->length_field && UNIQTYPE_IS_ARRAY_TYPE(field_info->type->ft_type))
+            {
+                vret = ArrayProxy_TraverseWithLength(data + field_info->offset,
+                        compositeproxy_boundlength(data, field_info), visit, arg,
+                        field_info->type);
+            }
+            else
+            {
+                vret = field_info->type->ft_traverse(data + field_info->offset,
+                        visit, arg, field_info->type);
+            }
             if (vret) return vret;
         }
     }
@@ -274,6 +389,7 @@ ForeignTypeObject *CompositeProxy_NewType(const struct uniqtype *type)
         PyObject_GC_NewVar(CompositeProxyTypeObject, &CompositeProxy_Metatype, 0);
     PyGetSetDef *getsetdefs = PyMem_Malloc((nb_fields + 1) * sizeof(PyGetSetDef));
     struct field_info *field_infos = PyMem_Malloc(nb_fields * sizeof(struct field_info));
+    struct init_step *init_plan = PyMem_Malloc(nb_fields * sizeof(struct init_step));
 
     for (int i_field = 0 ; i_field < nb_fields ; ++i_field)
     {
@@ -299,14 +415,21 @@ ForeignTypeObject *CompositeProxy_NewType(const struct uniqtype *type)
         .tp_getset = getsetdefs,
         .tp_init = (initproc) compositeproxy_init,
         .tp_repr = (reprfunc) compositeproxy_repr,
+        .tp_methods = compositeproxy_methods,
+        .tp_as_buffer = &compositeproxy_bufferprocs,
         .tp_traverse = (traverseproc) compositeproxy_traverse_py,
         .tp_clear = (inquiry) compositeproxy_clear_py,
         .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
     };
+    htype->fct_type = type;
     htype->fct_fieldinfos = field_infos;
+    htype->fct_initplan = init_plan; // Filled in InitType phase
+    htype->fct_nbinitsteps = 0;
 
     ForeignTypeObject *ftype = Proxy_NewType(type, (PyTypeObject *) htype);
     ftype->ft_constructor = compositeproxy_ctor;
+    ftype->ft_storeinto = compositeproxy_storeinto;
+    htype->fct_haspointers = ForeignType_ContainsPointers(ftype);
     ftype->ft_traverse = compositeproxy_traverse_ft;
     return ftype;
 }
@@ -314,6 +437,7 @@ ForeignTypeObject *CompositeProxy_NewType(const struct uniqtype *type)
 void CompositeProxy_InitType(ForeignTypeObject *self, const struct uniqtype *type)
 {
     PyTypeObject *proxytype = self->ft_proxy_type;
+    CompositeProxyTypeObject *ctype = (CompositeProxyTypeObject *) proxytype;
 
     for (int i_field = 0 ; proxytype->tp_getset[i_field].name ; ++i_field)
     {
@@ -322,12 +446,28 @@ void CompositeProxy_InitType(ForeignTypeObject *self, const struct uniqtype *typ
         struct field_info *finfo = proxytype->tp_getset[i_field].closure;
         finfo->type = ForeignType_GetOrCreate(field_rel_info->un.memb.ptr);
         finfo->offset = field_rel_info->un.memb.off;
+        finfo->length_field = NULL;
 
         if (finfo->type)
         {
             proxytype->tp_getset[i_field].get = (getter) compositeproxy_getfield;
-            if (ForeignType_IsTriviallyCopiable(finfo->type))
+
+            // Only fields with a recognized type take part in initialization
+            PyObject *name = PyUnicode_InternFromString(proxytype->tp_getset[i_field].name);
+            if (name)
+            {
+                ctype->fct_initplan[ctype->fct_nbinitsteps++] = (struct init_step){
+                    .field_info = finfo,
+                    .name = name,
+                    .index = i_field,
+                };
+            }
+            else PyErr_Clear(); // The field can still be accessed but not initialized
+            const struct uniqtype *ftyp = finfo->type->ft_type;
+            if (ForeignType_IsTriviallyCopiable(finfo->type) ||
+                    (UNIQTYPE_IS_ARRAY_TYPE(ftyp) && UNIQTYPE_HAS_KNOWN_LENGTH(ftyp)))
             {
+                // Assigning fixed size arrays copies their content
                 proxytype->tp_getset[i_field].set = (setter) compositeproxy_setfield;
             }
             if (finfo->offset == 0 && UNIQTYPE_IS_COMPOSITE_TYPE(finfo->type->ft_type))
@@ -344,3 +484,46 @@ void CompositeProxy_InitType(ForeignTypeObject *self, const struct uniqtype *typ
     int typready __attribute__((unused)) = PyType_Ready(proxytype);
     assert(typready == 0);
 }
+
+static struct field_info *compositeproxy_findfield(PyTypeObject *proxytype, const char *name)
+{
+    for (int i_field = 0 ; proxytype->tp_getset[i_field].name ; ++i_field)
+    {
+        if (strcmp(proxytype->tp_getset[i_field].name, name) == 0 &&
+                proxytype->tp_getset[i_field].get == (getter) compositeproxy_getfield)
+        {
+            return proxytype->tp_getset[i_field].closure;
+        }
+    }
+    PyErr_Format(PyExc_AttributeError, "Foreign composite '%s' has no usable field '%s'",
+            proxytype->tp_name, name);
+    return NULL;
+}
+
+// Declare that the number of items of the array or pointer field is stored
+// in the integer field length_field of the same structure
+int CompositeProxy_BindLength(ForeignTypeObject *self, const char *field, const char *length_field)
+{
+    PyTypeObject *proxytype = self->ft_proxy_type;
+    struct field_info *finfo = compositeproxy_findfield(proxytype, field);
+    if (!finfo) return -1;
+    struct field_info *length_finfo = compositeproxy_findfield(proxytype, length_field);
+    if (!length_finfo) return -1;
+
+    const struct uniqtype *ftyp = finfo->type->ft_type;
+    if (!UNIQTYPE_IS_POINTER_TYPE(ftyp) &&
+            !(UNIQTYPE_IS_ARRAY_TYPE(ftyp) && !UNIQTYPE_HAS_KNOWN_LENGTH(ftyp)))
+    {
+        PyErr_Format(PyExc_TypeError,
+            "Field '%s' must be a pointer or a flexible array to have a bound length", field);
+        return -1;
+    }
+    if (!ForeignBaseType_IsInteger(length_finfo->type->ft_type))
+    {
+        PyErr_Format(PyExc_TypeError, "Length field '%s' must be an integer", length_field);
+        return -1;
+    }
+
+    finfo->length_field = length_finfo;
+    return 0;
+}
@@ -21,6 +21,18 @@ static int bool_storeinto(PyObject *obj, void *dest, ForeignTypeObject *type)
     return 0;
 }
 
+static int uint_overflow(int size)
+{
+    PyErr_Format(PyExc_OverflowError, "argument does not fit into a %d bit unsigned integer", size);
+    return -1;
+}
+
+static int int_overflow(int size)
+{
+    PyErr_Format(PyExc_OverflowError, "argument does not fit into a %d bit signed integer", size);
+    return -1;
+}
+
 #define DEFINE_UINT_GETSTORE(size) \
 static PyObject *uint##size##_getfrom(void *data, ForeignTypeObject *type)\
 {\
@@ -34,11 +46,7 @@ static int uint##size##_storeinto(PyObject *obj, void *dest, ForeignTypeObject *
     if (PyErr_Occurred()) return -1;\
 \
     /* Check for overflows */\
-    if (u > UINT##size##_MAX)\
-    {\
-        PyErr_SetString(PyExc_OverflowError, "argument does not fit into a " #size " bit unsigned integer");\
-        return -1;\
-    }\
+    if (u > UINT##size##_MAX) return uint_overflow(size);\
 \
     *(uint##size##_t *)dest = (uint##size##_t) u;\
     return 0;\
@@ -48,6 +56,38 @@ DEFINE_UINT_GETSTORE(16)
 DEFINE_UINT_GETSTORE(32)
 DEFINE_UINT_GETSTORE(64)
 
+// Bulk stores convert exact ints in a tight loop, range checking each value
+// before writing it. Other objects and values that do not fit in a long long
+// use the single item store.
+#define DEFINE_UINT_STOREMANY(size) \
+static int uint##size##_storemany(PyObject *const *items, Py_ssize_t n, void *dest, ForeignTypeObject *type)\
+{\
+    uint##size##_t *out = dest;\
+    for (Py_ssize_t i = 0 ; i < n ; ++i)\
+    {\
+        int overflow = 1;\
+        long long v = 0;\
+        if (PyLong_CheckExact(items[i])) v = PyLong_AsLongLongAndOverflow(items[i], &overflow);\
+        if (overflow)\
+        {\
+            if (uint##size##_storeinto(items[i], &out[i], type) < 0) return -1;\
+            continue;\
+        }\
+        if (v < 0)\
+        {\
+            PyErr_SetString(PyExc_OverflowError, "can't convert negative int to unsigned");\
+            return -1;\
+        }\
+        if ((unsigned long long) v > UINT##size##_MAX) return uint_overflow(size);\
+        out[i] = (uint##size##_t) v;\
+    }\
+    return 0;\
+}
+DEFINE_UINT_STOREMANY(8)
+DEFINE_UINT_STOREMANY(16)
+DEFINE_UINT_STOREMANY(32)
+DEFINE_UINT_STOREMANY(64)
+
 #define DEFINE_INT_GETSTORE(size) \
 static PyObject *int##size##_getfrom(void *data, ForeignTypeObject *type)\
 {\
@@ -61,11 +101,7 @@ static int int##size##_storeinto(PyObject *obj, void *dest, ForeignTypeObject *t
     if (PyErr_Occurred()) return -1;\
 \
     /* Check for overflows & underflows */ \
-    if (i < INT##size##_MIN || i > INT##size##_MAX)\
-    {\
-        PyErr_SetString(PyExc_OverflowError, "argument does not fit into a " #size " bit signed integer");\
-        return -1;\
-    }\
+    if (i < INT##size##_MIN || i > INT##size##_MAX) return int_overflow(size);\
 \
     *(int##size##_t *)dest = (int##size##_t) i;\
     return 0;\
@@ -75,6 +111,30 @@ DEFINE_INT_GETSTORE(16)
 DEFINE_INT_GETSTORE(32)
 DEFINE_INT_GETSTORE(64)
 
+#define DEFINE_INT_STOREMANY(size) \
+static int int##size##_storemany(PyObject *const *items, Py_ssize_t n, void *dest, ForeignTypeObject *type)\
+{\
+    int##size##_t *out = dest;\
+    for (Py_ssize_t i = 0 ; i < n ; ++i)\
+    {\
+        int overflow = 1;\
+        long long v = 0;\
+        if (PyLong_CheckExact(items[i])) v = PyLong_AsLongLongAndOverflow(items[i], &overflow);\
+        if (overflow)\
+        {\
+            if (int##size##_storeinto(items[i], &out[i], type) < 0) return -1;\
+            continue;\
+        }\
+        if (v < INT##size##_MIN || v > INT##size##_MAX) return int_overflow(size);\
+        out[i] = (int##size##_t) v;\
+    }\
+    return 0;\
+}
+DEFINE_INT_STOREMANY(8)
+DEFINE_INT_STOREMANY(16)
+DEFINE_INT_STOREMANY(32)
+DEFINE_INT_STOREMANY(64)
+
 // Adapted from builtin_ord
 static PyObject *char_to_long(PyObject* c)
 {
@@ -166,6 +226,21 @@ DEFINE_FLOAT_GETSTORE(double)
 typedef long double long_double;
 DEFINE_FLOAT_GETSTORE(long_double)
 
+#define DEFINE_FLOAT_STOREMANY(t) \
+static int t##_storemany(PyObject *const *items, Py_ssize_t n, void *dest, ForeignTypeObject *type)\
+{\
+    t *out = dest;\
+    for (Py_ssize_t i = 0 ; i < n ; ++i)\
+    {\
+        if (PyFloat_CheckExact(items[i])) out[i] = (t) PyFloat_AS_DOUBLE(items[i]);\
+        else if (t##_storeinto(items[i], &out[i], type) < 0) return -1;\
+    }\
+    return 0;\
+}
+DEFINE_FLOAT_STOREMANY(float)
+DEFINE_FLOAT_STOREMANY(double)
+DEFINE_FLOAT_STOREMANY(long_double)
+
 #ifndef __STDC_NO_COMPLEX__
 #define DEFINE_COMPLEX_GETSTORE(t) \
 static PyObject *t##_getfrom(void *data, ForeignTypeObject *type)\
@@ -190,12 +265,13 @@ typedef complex long double cmplx_long_double;
 DEFINE_COMPLEX_GETSTORE(cmplx_long_double)
 #endif
 
-#define CHECK_SIZE(sz, getfrom, storeinto) \
+#define CHECK_SIZE(sz, getfrom, storeinto, storemany) \
 if (size == sz)\
 {\
     obj->ft_getfrom = getfrom;\
     obj->ft_copyfrom = getfrom;\
     obj->ft_storeinto = storeinto;\
+    obj->ft_storemany = storemany;\
     break;\
 }
 
@@ -206,6 +282,7 @@ ForeignTypeObject *ForeignBaseType_New(const struct uniqtype *type)
     obj->ft_type = type;
     obj->ft_proxy_type = NULL;
     obj->ft_constructor = NULL;
+    obj->ft_storemany = NULL;
     obj->ft_getdataptr = NULL;
     obj->ft_traverse = NULL;
 
@@ -221,54 +298,54 @@ ForeignTypeObject *ForeignBaseType_New(const struct uniqtype *type)
 
         case DW_ATE_address:
         case DW_ATE_unsigned:
-            CHECK_SIZE(1, uint8_getfrom, uint8_storeinto)
-            CHECK_SIZE(2, uint16_getfrom, uint16_storeinto)
-            CHECK_SIZE(4, uint32_getfrom, uint32_storeinto)
-            CHECK_SIZE(8, uint64_getfrom, uint64_storeinto)
+            CHECK_SIZE(1, uint8_getfrom, uint8_storeinto, uint8_storemany)
+            CHECK_SIZE(2, uint16_getfrom, uint16_storeinto, uint16_storemany)
+            CHECK_SIZE(4, uint32_getfrom, uint32_storeinto, uint32_storemany)
+            CHECK_SIZE(8, uint64_getfrom, uint64_storeinto, uint64_storemany)
 
             PyErr_SetString(PyExc_TypeError, "Unsupported foreign unsigned integer parameter");
             break;
 
         case DW_ATE_signed:
-            CHECK_SIZE(1, int8_getfrom, int8_storeinto)
-            CHECK_SIZE(2, int16_getfrom, int16_storeinto)
-            CHECK_SIZE(4, int32_getfrom, int32_storeinto)
-            CHECK_SIZE(8, int64_getfrom, int64_storeinto)
+            CHECK_SIZE(1, int8_getfrom, int8_storeinto, int8_storemany)
+            CHECK_SIZE(2, int16_getfrom, int16_storeinto, int16_storemany)
+            CHECK_SIZE(4, int32_getfrom, int32_storeinto, int32_storemany)
+            CHECK_SIZE(8, int64_getfrom, int64_storeinto, int64_storemany)
 
             PyErr_SetString(PyExc_TypeError, "Unsupported foreign signed integer parameter");
             break;
 
         case DW_ATE_unsigned_char:
-            CHECK_SIZE(1, char8_getfrom, uchar8_storeinto)
-            CHECK_SIZE(2, char16_getfrom, uchar16_storeinto)
-            CHECK_SIZE(4, char32_getfrom, uchar32_storeinto)
-            CHECK_SIZE(8, char64_getfrom, uchar64_storeinto)
+            CHECK_SIZE(1, char8_getfrom, uchar8_storeinto, NULL)
+            CHECK_SIZE(2, char16_getfrom, uchar16_storeinto, NULL)
+            CHECK_SIZE(4, char32_getfrom, uchar32_storeinto, NULL)
+            CHECK_SIZE(8, char64_getfrom, uchar64_storeinto, NULL)
 
             PyErr_SetString(PyExc_TypeError, "Unsupported foreign unsigned character parameter");
             break;
 
         case DW_ATE_signed_char:
-            CHECK_SIZE(1, char8_getfrom, schar8_storeinto)
-            CHECK_SIZE(2, char16_getfrom, schar16_storeinto)
-            CHECK_SIZE(4, char32_getfrom, schar32_storeinto)
-            CHECK_SIZE(8, char64_getfrom, schar64_storeinto)
+            CHECK_SIZE(1, char8_getfrom, schar8_storeinto, NULL)
+            CHECK_SIZE(2, char16_getfrom, schar16_storeinto, NULL)
+            CHECK_SIZE(4, char32_getfrom, schar32_storeinto, NULL)
+            CHECK_SIZE(8, char64_getfrom, schar64_storeinto, NULL)
 
             PyErr_SetString(PyExc_TypeError, "Unsupported foreign signed character parameter");
             break;
 
         case DW_ATE_float:
-            CHECK_SIZE(4, float_getfrom, float_storeinto)
-            CHECK_SIZE(8, double_getfrom, double_storeinto)
-            CHECK_SIZE(16, long_double_getfrom, long_double_storeinto)
+            CHECK_SIZE(4, float_getfrom, float_storeinto, float_storemany)
+            CHECK_SIZE(8, double_getfrom, double_storeinto, double_storemany)
+            CHECK_SIZE(16, long_double_getfrom, long_double_storeinto, long_double_storemany)
 
             PyErr_SetString(PyExc_TypeError, "Unsupported foreign float parameter");
             break;
 
 #ifndef __STDC_NO_COMPLEX__
         case DW_ATE_complex_float:
-            CHECK_SIZE(8, cmplx_float_getfrom, cmplx_float_storeinto)
-            CHECK_SIZE(16, cmplx_double_getfrom, cmplx_double_storeinto)
-            CHECK_SIZE(32, cmplx_long_double_getfrom, cmplx_long_double_storeinto)
+            CHECK_SIZE(8, cmplx_float_getfrom, cmplx_float_storeinto, NULL)
+            CHECK_SIZE(16, cmplx_double_getfrom, cmplx_double_storeinto, NULL)
+            CHECK_SIZE(32, cmplx_long_double_getfrom, cmplx_long_double_storeinto, NULL)
 
             PyErr_SetString(PyExc_TypeError, "Unsupported foreign complex parameter");
             break;
@@ -305,3 +382,84 @@ bool ForeignBaseType_IsChar(const struct uniqtype *type)
             return 0;
     }
 }
+
+// Check if type is a pointer to single byte characters (i.e. a C string)
+bool ForeignBaseType_IsCharPointer(const struct uniqtype *type)
+{
+    if (UNIQTYPE_KIND(type) != ADDRESS) return 0;
+    const struct uniqtype *pointee = UNIQTYPE_POINTEE_TYPE(type);
+    return pointee && ForeignBaseType_IsChar(pointee) && UNIQTYPE_SIZE_IN_BYTES(pointee) == 1;
+}
+
+// Check if type is a plain integer type that can be used to store lengths
+bool ForeignBaseType_IsInteger(const struct uniqtype *type)
+{
+    if (!UNIQTYPE_IS_BASE_TYPE(type)) return 0;
+    unsigned size = UNIQTYPE_SIZE_IN_BYTES(type);
+    if (UNIQTYPE_BASE_TYPE_BIT_SIZE(type) != 8*size) return 0;
+    if (type->un.base.enc != DW_ATE_signed && type->un.base.enc != DW_ATE_unsigned) return 0;
+    return size == 1 || size == 2 || size == 4 || size == 8;
+}
+
+// Read a length stored in an integer of the given type (checked with
+// ForeignBaseType_IsInteger). Negative values are read as 0.
+Py_ssize_t ForeignBaseType_ReadLength(const void *data, const struct uniqtype *type)
+{
+    bool is_signed = type->un.base.enc == DW_ATE_signed;
+    long long value;
+    switch (UNIQTYPE_SIZE_IN_BYTES(type))
+    {
+        case 1: value = is_signed ? *(int8_t *) data : *(uint8_t *) data; break;
+        case 2: value = is_signed ? *(int16_t *) data : *(uint16_t *) data; break;
+        case 4: value = is_signed ? *(int32_t *) data : *(uint32_t *) data; break;
+        default:
+            if (!is_signed && *(uint64_t *) data > PY_SSIZE_T_MAX) return PY_SSIZE_T_MAX;
+            value = *(int64_t *) data;
+            break;
+    }
+    if (value < 0) return 0;
+    return value > PY_SSIZE_T_MAX ? PY_SSIZE_T_MAX : value;
+}
+
+// Get the PEP 3118 format code of a base type, using either native or
+// standard sizes. Returns NULL if there is no matching code.
+const char *ForeignBaseType_FormatCode(const struct uniqtype *type, bool native)
+{
+    unsigned size = UNIQTYPE_SIZE_IN_BYTES(type);
+    if (UNIQTYPE_BASE_TYPE_BIT_SIZE(type) != 8*size) return NULL;
+
+    switch (type->un.base.enc)
+    {
+        case DW_ATE_boolean:
+            return size == 1 ? "?" : NULL;
+        case DW_ATE_unsigned_char:
+        case DW_ATE_signed_char:
+            if (size == 1) return "c";
+            // Wide characters are exposed as integers
+            // fall through
+        case DW_ATE_address:
+        case DW_ATE_unsigned:
+        case DW_ATE_signed:
+        {
+            bool is_signed = type->un.base.enc == DW_ATE_signed ||
+                type->un.base.enc == DW_ATE_signed_char;
+            if (size == 1) return is_signed ? "b" : "B";
+            if (size == 2) return is_signed ? "h" : "H";
+            if (size == 4) return is_signed ? "i" : "I";
+            if (size == 8) return is_signed ? "q" : "Q";
+            return NULL;
+        }
+        case DW_ATE_float:
+            if (size == 4) return "f";
+            if (size == 8) return "d";
+            if (size == 16 && native) return "g";
+            return NULL;
+        case DW_ATE_complex_float:
+            if (size == 8) return "Zf";
+            if (size == 16) return "Zd";
+            if (size == 32 && native) return "Zg";
+            return NULL;
+        default:
+            return NULL;
+    }
+}
@@ -1,4 +1,6 @@
 #include "foreign_library.h"
+#include <dlfcn.h>
+#include <stdarg.h>
 
 static PyObject *foreigntype_call(ForeignTypeObject *self, PyObject *args, PyObject *kwargs)
 {
@@ -77,12 +79,115 @@ static PyObject *foreigntype_fun(ForeignTypeObject *self, PyObject *args)
     return (PyObject *) ForeignType_GetOrCreate(funtype);
 }
 
+static PyObject *foreigntype_from_buffer(ForeignTypeObject *self, PyObject *arg)
+{
+    const struct uniqtype *type = self->ft_type;
+    if (!self->ft_constructor ||
+        (UNIQTYPE_KIND(type) != COMPOSITE && UNIQTYPE_KIND(type) != ARRAY))
+    {
+        PyErr_Format(PyExc_TypeError,
+            "Cannot build data of type '%s' from a buffer", UNIQTYPE_NAME(type));
+        return NULL;
+    }
+    if (ForeignType_ContainsPointers(self))
+    {
+        // Raw bytes cannot carry pointer targets or their lifetime information
+        PyErr_Format(PyExc_TypeError,
+            "Cannot build data of type '%s' containing pointers from a buffer",
+            UNIQTYPE_NAME(type));
+        return NULL;
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(arg, &view, PyBUF_C_CONTIGUOUS) < 0) return NULL;
+
+    PyObject *obj = NULL;
+    Py_ssize_t itemsize = self->ft_proxy_type->tp_itemsize;
+    if (itemsize == 0 || view.len % itemsize != 0 ||
+        (UNIQTYPE_KIND(type) == COMPOSITE && view.len != itemsize))
+    {
+        PyErr_Format(PyExc_ValueError,
+            "Buffer size %zd does not match foreign type '%s'",
+            view.len, UNIQTYPE_NAME(type));
+        goto out;
+    }
+
+    // Construct a zero initialized object of the right size and fill it
+    PyObject *ctor_args = UNIQTYPE_KIND(type) == ARRAY ?
+        Py_BuildValue("(n)", view.len / itemsize) : PyTuple_New(0);
+    if (!ctor_args) goto out;
+    obj = self->ft_constructor(ctor_args, NULL, self);
+    Py_DECREF(ctor_args);
+    if (obj) memcpy(((ProxyObject *) obj)->p_ptr, view.buf, view.len);
+
+out:
+    PyBuffer_Release(&view);
+    return obj;
+}
+
+static PyObject *foreigntype_reduce(ForeignTypeObject *self)
+{
+    const struct uniqtype *type = self->ft_type;
+
+    // Derived types are rebuilt from their base type, because they are not
+    // always backed by a symbol (e.g. when created by liballocs on demand).
+    const char *derived_attr = NULL;
+    if (UNIQTYPE_KIND(type) == ADDRESS) derived_attr = "ptr";
+    else if (UNIQTYPE_KIND(type) == ARRAY && !UNIQTYPE_HAS_KNOWN_LENGTH(type))
+        derived_attr = "array";
+    if (derived_attr)
+    {
+        PyObject *getattr_fn = PyDict_GetItemString(PyEval_GetBuiltins(), "getattr");
+        return Py_BuildValue("O(Ns)", getattr_fn,
+            ForeignType_GetOrCreate(type->related[0].un.t.ptr), derived_attr);
+    }
+
+    // Other uniqtypes are symbols that can be found again by name, as long as
+    // the unpickling process has loaded the same libraries.
+    Dl_info dlinfo;
+    if (dladdr(type, &dlinfo) && dlinfo.dli_sname && dlinfo.dli_saddr == type)
+    {
+        PyObject *allocs_module = PyImport_ImportModule("allocs");
+        if (!allocs_module) return NULL;
+        PyObject *rebuild = PyObject_GetAttrString(allocs_module, "_type_from_symbol");
+        Py_DECREF(allocs_module);
+        return Py_BuildValue("N(s)", rebuild, dlinfo.dli_sname);
+    }
+
+    PyErr_Format(PyExc_TypeError, "Cannot pickle foreign type '%s'", UNIQTYPE_NAME(type));
+    return NULL;
+}
+
+static PyObject *foreigntype_bind_length(ForeignTypeObject *self, PyObject *args)
+{
+    const char *field, *length_field;
+    if (!PyArg_ParseTuple(args, "ss", &field, &length_field)) return NULL;
+
+    if (!UNIQTYPE_IS_COMPOSITE_TYPE(self->ft_type) || !self->ft_proxy_type)
+    {
+        PyErr_Format(PyExc_TypeError, "Foreign type '%s' is not a composite",
+                UNIQTYPE_NAME(self->ft_type));
+        return NULL;
+    }
+    if (CompositeProxy_BindLength(self, field, length_field) < 0) return NULL;
+    Py_RETURN_NONE;
+}
+
 static PyMethodDef foreigntype_methods[] = {
     {"fun", (PyCFunction) foreigntype_fun, METH_VARARGS,
         "Get a function type with the current type as return type. "
         "All the arguments should be types, and correspond to argument types. "
         "`ret.fun(arg)` is the types of functions taking an argument of type "
         "arg and returning a value of type ret."},
+    {"from_buffer", (PyCFunction) foreigntype_from_buffer, METH_O,
+        "Build a new struct or array of the current type from a copy of the "
+        "given buffer. Arrays get their length from the buffer size."},
+    {"bind_length", (PyCFunction) foreigntype_bind_length, METH_VARARGS,
+        "bind_length(field, length_field): declare that the number of items of "
+        "the pointer or flexible array field is stored in the integer field "
+        "length_field of the same structure. Accessing field then does not "
+        "need to query the bounds of the array."},
+    {"__reduce__", (PyCFunction) foreigntype_reduce, METH_NOARGS, NULL},
     {NULL}
 };
 
@@ -131,6 +236,9 @@ static ForeignTypeObject *ForeignType_New(const struct uniqtype *type)
             ftype->ft_getfrom = void_getfrom;
             ftype->ft_copyfrom = void_getfrom;
             ftype->ft_storeinto = void_storeinto;
+            ftype->ft_storemany = NULL;
+            ftype->ft_getdataptr = NULL;
+            ftype->ft_traverse = NULL;
             return ftype;
         }
         case BASE:
@@ -176,8 +284,7 @@ ForeignTypeObject *ForeignType_GetOrCreate(const struct uniqtype *type)
     // This function makes the assumption that uniqtype's have infinite lifetime
     // Our ForeignTypeObject's have too (no GC and storage in a static table)
 
-    static PyObject *typdict = NULL;
-    if (!typdict) typdict = PyDict_New();
+    PyObject *typdict = Allocs_GetState()->type_dict;
 
     PyObject *typkey = PyLong_FromVoidPtr((void *) type);
     PyObject *ptype = PyDict_GetItem(typdict, typkey);
@@ -196,6 +303,31 @@ ForeignTypeObject *ForeignType_GetOrCreate(const struct uniqtype *type)
     return (ForeignTypeObject *) ptype;
 }
 
+static bool uniqtype_contains_pointers(const struct uniqtype *type)
+{
+    switch (UNIQTYPE_KIND(type))
+    {
+        case ADDRESS:
+        case SUBPROGRAM:
+            return true;
+        case ARRAY:
+            return uniqtype_contains_pointers(UNIQTYPE_ARRAY_ELEMENT_TYPE(type));
+        case COMPOSITE:
+            for (unsigned i = 0; i < UNIQTYPE_COMPOSITE_MEMBER_COUNT(type); ++i)
+            {
+                if (uniqtype_contains_pointers(type->related[i].un.memb.ptr)) return true;
+            }
+            return false;
+        default:
+            return false;
+    }
+}
+
+bool ForeignType_ContainsPointers(const ForeignTypeObject *type)
+{
+    return uniqtype_contains_pointers(type->ft_type);
+}
+
 bool ForeignType_IsTriviallyCopiable(const ForeignTypeObject *type)
 {
     switch (UNIQTYPE_KIND(type->ft_type))
@@ -208,3 +340,145 @@ bool ForeignType_IsTriviallyCopiable(const ForeignTypeObject *type)
             return true;
     }
 }
+
+// Growable string used to build buffer format strings
+struct format_buf {
+    char *str;
+    size_t len;
+    size_t cap;
+};
+
+static bool format_append(struct format_buf *fmt, const char *fmtstr, ...)
+{
+    while (true)
+    {
+        va_list ap;
+        va_start(ap, fmtstr);
+        int n = vsnprintf(fmt->str + fmt->len, fmt->cap - fmt->len, fmtstr, ap);
+        va_end(ap);
+        if (n < 0) return false;
+        if (fmt->len + n < fmt->cap)
+        {
+            fmt->len += n;
+            return true;
+        }
+
+        size_t newcap = 2 * (fmt->len + n + 1);
+        char *newstr = PyMem_Realloc(fmt->str, newcap);
+        if (!newstr) return false;
+        fmt->str = newstr;
+        fmt->cap = newcap;
+    }
+}
+
+static bool format_append_composite(struct format_buf *fmt, const struct uniqtype *type);
+
+// Append the format of a struct member, with standard sizes.
+// Returns false if the type has no struct syntax representation.
+static bool format_append_member(struct format_buf *fmt, const struct uniqtype *type)
+{
+    switch (UNIQTYPE_KIND(type))
+    {
+        case BASE:
+        {
+            const char *code = ForeignBaseType_FormatCode(type, false);
+            return code && format_append(fmt, "%s", code);
+        }
+        case ADDRESS:
+            // There is no standard size pointer code
+            return format_append(fmt, sizeof(void *) == 8 ? "Q" : "I");
+        case ARRAY:
+        {
+            // Arrays of arrays are described by a single multi-dimensional
+            // shape, e.g. (2,3)i for int[2][3]
+            if (!format_append(fmt, "(")) return false;
+            const char *sep = "";
+            while (UNIQTYPE_IS_ARRAY_TYPE(type))
+            {
+                if (!UNIQTYPE_HAS_KNOWN_LENGTH(type)) return false;
+                if (!format_append(fmt, "%s%d", sep, UNIQTYPE_ARRAY_LENGTH(type)))
+                    return false;
+                sep = ",";
+                type = UNIQTYPE_ARRAY_ELEMENT_TYPE(type);
+            }
+            return format_append(fmt, ")") && format_append_member(fmt, type);
+        }
+        case COMPOSITE:
+            return format_append_composite(fmt, type);
+        default:
+            return false;
+    }
+}
+
+// Append a struct syntax format for a composite with explicit padding.
+// Composites that cannot be described this way (unions, bit fields,
+// unsupported members) are exposed as opaque byte strings.
+static bool format_append_composite(struct format_buf *fmt, const struct uniqtype *type)
+{
+    size_t start = fmt->len;
+    unsigned size = UNIQTYPE_SIZE_IN_BYTES(type);
+    const char **names = UNIQTYPE_COMPOSITE_SUBOBJ_NAMES(type);
+    if (!names || !format_append(fmt, "T{=")) goto opaque;
+
+    unsigned cursor = 0;
+    for (unsigned i = 0; i < UNIQTYPE_COMPOSITE_MEMBER_COUNT(type); ++i)
+    {
+        const struct uniqtype *membtype = type->related[i].un.memb.ptr;
+        unsigned offset = type->related[i].un.memb.off;
+        if (!membtype) goto opaque;
+        // Flexible array members are not part of the element
+        if (!UNIQTYPE_HAS_KNOWN_LENGTH(membtype)) continue;
+        // Overlapping members cannot be described
+        if (offset < cursor) goto opaque;
+
+        if (offset > cursor && !format_append(fmt, "%ux", offset - cursor)) goto opaque;
+        if (!format_append_member(fmt, membtype)) goto opaque;
+        if (!format_append(fmt, ":%s:", names[i])) goto opaque;
+        cursor = offset + UNIQTYPE_SIZE_IN_BYTES(membtype);
+    }
+    if (cursor > size) goto opaque;
+    if (size > cursor && !format_append(fmt, "%ux", size - cursor)) goto opaque;
+    if (format_append(fmt, "}")) return true;
+
+opaque:
+    fmt->len = start;
+    return format_append(fmt, "%us", size);
+}
+
+// Returns a PyMem allocated buffer format string describing one element of
+// the given type, or NULL with a Python exception set.
+char *ForeignType_BufferFormat(const struct uniqtype *type)
+{
+    struct format_buf fmt = { NULL, 0, 0 };
+    bool success;
+    switch (UNIQTYPE_KIND(type))
+    {
+        case BASE:
+        {
+            // Single native codes can be used by memoryview indexing
+            const char *code = ForeignBaseType_FormatCode(type, true);
+            if (code) success = format_append(&fmt, "%s", code);
+            else success = format_append(&fmt, "%us", UNIQTYPE_SIZE_IN_BYTES(type));
+            break;
+        }
+        case COMPOSITE:
+            success = format_append_composite(&fmt, type);
+            break;
+        default:
+            if (!format_append_member(&fmt, type))
+            {
+                fmt.len = 0;
+                success = format_append(&fmt, "%us", UNIQTYPE_SIZE_IN_BYTES(type));
+            }
+            else success = true;
+            break;
+    }
+
+    if (!success)
+    {
+        PyMem_Free(fmt.str);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    return fmt.str;
+}
@@ -2,6 +2,7 @@
 #include <liballocs.h>
 #include <ffi.h>
 #include <dwarf.h>
+#include "structmember.h"
 
 typedef struct {
     PyTypeObject tp_base;
@@ -10,6 +11,9 @@ typedef struct {
     ForeignTypeObject **ff_argtypes;
     ForeignTypeObject *ff_rettype;
     PyTypeObject *ff_closure_type;
+    // Pointee types of the parameters accepting ByRef objects (pointers to
+    // base types), or NULL if there is no such parameter
+    ForeignTypeObject **ff_reftypes;
 } FunctionProxyTypeObject;
 
 static void free_ffi_type_arr(ffi_type **arr);
@@ -138,6 +142,30 @@ static ffi_type *ffi_type_for_uniqtype(const struct uniqtype *type)
     }
 }
 
+static void funproxytype_setupreftypes(FunctionProxyTypeObject *self)
+{
+    unsigned narg = self->ff_type->un.subprogram.narg;
+    bool has_ref = false;
+    self->ff_reftypes = narg > 0 ? PyMem_Calloc(narg, sizeof(ForeignTypeObject *)) : NULL;
+    if (!self->ff_reftypes) return;
+    for (unsigned i = 0 ; i < narg ; ++i)
+    {
+        const struct uniqtype *arg_type = self->ff_argtypes[i]->ft_type;
+        if (!UNIQTYPE_IS_POINTER_TYPE(arg_type)) continue;
+        const struct uniqtype *pointee = UNIQTYPE_POINTEE_TYPE(arg_type);
+        if (!pointee || !UNIQTYPE_IS_BASE_TYPE(pointee)) continue;
+
+        self->ff_reftypes[i] = ForeignType_GetOrCreate(pointee);
+        if (self->ff_reftypes[i]) has_ref = true;
+        else PyErr_Clear(); // The parameter will not accept ByRef objects
+    }
+    if (!has_ref)
+    {
+        PyMem_Free(self->ff_reftypes);
+        self->ff_reftypes = NULL;
+    }
+}
+
 /* funproxytype_setup returns a negative value and sets a Python exception
  * on failure */
 static int funproxytype_setup(FunctionProxyTypeObject *self)
@@ -191,6 +219,7 @@ static int funproxytype_setup(FunctionProxyTypeObject *self)
     if (ffi_prep_cif(cif, FFI_DEFAULT_ABI, narg, ffi_ret_type, ffi_arg_types) == FFI_OK)
     {
         self->ff_cif = cif;
+        funproxytype_setupreftypes(self);
         return 0;
     }
 
@@ -233,6 +262,13 @@ static void funproxytype_dealloc(FunctionProxyTypeObject *self)
         PyMem_Free(self->ff_argtypes);
 
         Py_DECREF(self->ff_rettype);
+
+        if (self->ff_reftypes)
+        {
+            unsigned narg = self->ff_type->un.subprogram.narg;
+            for (unsigned i = 0; i < narg; ++i) Py_XDECREF(self->ff_reftypes[i]);
+            PyMem_Free(self->ff_reftypes);
+        }
     }
     Py_XDECREF(self->ff_closure_type);
     Py_TYPE(self)->tp_free((PyObject *) self);
@@ -248,10 +284,126 @@ PyTypeObject FunctionProxy_Metatype = {
     .tp_dealloc = (destructor) funproxytype_dealloc,
 };
 
-static PyObject *funproxy_call(ProxyObject *self, PyObject *args, PyObject *kwds)
+typedef struct {
+    PyObject_HEAD
+    PyObject *br_value;
+} ByRefObject;
+
+static int byref_init(ByRefObject *self, PyObject *args, PyObject *kwds)
 {
-    FunctionProxyTypeObject *type = (FunctionProxyTypeObject *) Py_TYPE(self);
-    if (funproxytype_setup(type) < 0) return NULL;
+    static char *keywords[] = { "value", NULL };
+    PyObject *value = Py_None;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:ByRef", keywords, &value)) return -1;
+    Py_INCREF(value);
+    Py_XSETREF(self->br_value, value);
+    return 0;
+}
+
+static PyObject *byref_repr(ByRefObject *self)
+{
+    return PyUnicode_FromFormat("ByRef(%R)", self->br_value ? self->br_value : Py_None);
+}
+
+static int byref_traverse(ByRefObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(Py_TYPE(self));
+    Py_VISIT(self->br_value);
+    return 0;
+}
+
+static int byref_clear(ByRefObject *self)
+{
+    Py_CLEAR(self->br_value);
+    return 0;
+}
+
+static void byref_dealloc(ByRefObject *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+    PyObject_GC_UnTrack(self);
+    byref_clear(self);
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+static PyMemberDef byref_members[] = {
+    {"value", T_OBJECT, offsetof(ByRefObject, br_value), 0,
+        "Value pointed to by the argument, updated after each call"},
+    {NULL}
+};
+
+static PyType_Slot byref_slots[] = {
+    {Py_tp_doc, "ByRef(value=None): out-parameter for foreign functions taking "
+        "a pointer to a scalar. The function receives a pointer to a "
+        "temporary initialized with value (zero if None), and value is set to "
+        "its content after the call."},
+    {Py_tp_new, PyType_GenericNew},
+    {Py_tp_init, byref_init},
+    {Py_tp_repr, byref_repr},
+    {Py_tp_traverse, byref_traverse},
+    {Py_tp_clear, byref_clear},
+    {Py_tp_dealloc, byref_dealloc},
+    {Py_tp_members, byref_members},
+    {0, NULL}
+};
+
+PyType_Spec ByRef_TypeSpec = {
+    .name = "allocs.ByRef",
+    .basicsize = sizeof(ByRefObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC,
+    .slots = byref_slots,
+};
+
+// Get the pointee type of the parameter i if it receives a ByRef object
+static ForeignTypeObject *funproxy_reftype(FunctionProxyTypeObject *type, unsigned i, PyObject *py_arg)
+{
+    if (!type->ff_reftypes || !type->ff_reftypes[i]) return NULL;
+    return PyObject_TypeCheck(py_arg, Allocs_GetState()->byref_type) ? type->ff_reftypes[i] : NULL;
+}
+
+// Set the value of ByRef arguments to the content of their cell after the call
+static int funproxy_updaterefs(FunctionProxyTypeObject *type, PyObject *args, void **ff_args)
+{
+    if (!type->ff_reftypes) return 0;
+
+    unsigned narg = type->ff_type->un.subprogram.narg;
+    for (unsigned i = 0 ; i < narg ; ++i)
+    {
+        PyObject *py_arg = PySequence_Fast_GET_ITEM(args, i);
+        ForeignTypeObject *ref_ftype = funproxy_reftype(type, i, py_arg);
+        if (!ref_ftype) continue;
+
+        PyObject *value = ref_ftype->ft_copyfrom(*(void **) ff_args[i], ref_ftype);
+        if (!value) return -1;
+        Py_XSETREF(((ByRefObject *) py_arg)->br_value, value);
+    }
+    return 0;
+}
+
+// Get a C string for a str or bytes argument, valid as long as the argument
+// is alive. Nothing is allocated: str arguments use the UTF-8 buffer cached
+// by the str object. Strings with embedded null characters are rejected as C
+// code would see them truncated. C code must not modify the string or keep
+// it after the call.
+static const char *funproxy_callscopedstring(PyObject *obj)
+{
+    char *str;
+    if (PyBytes_Check(obj)) return PyBytes_AsStringAndSize(obj, &str, NULL) < 0 ? NULL : str;
+
+    Py_ssize_t size;
+    const char *utf8 = PyUnicode_AsUTF8AndSize(obj, &size);
+    if (!utf8) return NULL;
+    if (strlen(utf8) != (size_t) size)
+    {
+        PyErr_SetString(PyExc_ValueError, "embedded null character");
+        return NULL;
+    }
+    return utf8;
+}
+
+static int funproxy_checkargs(FunctionProxyTypeObject *type, PyObject *args)
+{
+    if (funproxytype_setup(type) < 0) return -1;
 
     unsigned narg = type->ff_type->un.subprogram.narg;
     if (PySequence_Fast_GET_SIZE(args) != narg)
@@ -259,23 +411,46 @@ static PyObject *funproxy_call(ProxyObject *self, PyObject *args, PyObject *kwds
         PyErr_Format(PyExc_TypeError,
                      "This function takes exactly %d argument%s (%d given)",
                      narg, narg == 1 ? "" : "s", PySequence_Fast_GET_SIZE(args));
-        return NULL;
+        return -1;
     }
+    return 0;
+}
 
-    // TODO: Handle keywords arguments (need liballocs support)
-
-    // Using libffi to make calls is probably highly inefficient as some
-    // arguments will be pushed to the stack twice.
-    void *ff_args[narg];
-    unsigned argsize = 0;
+// First step of argument conversion: point ff_args to the native data of the
+// arguments that already have one. Returns the number of bytes needed by
+// funproxy_storeargs for storing the other ones, or -1 on error.
+// ff_args and str_args must have room for one item per argument.
+static Py_ssize_t funproxy_bindargs(FunctionProxyTypeObject *type, PyObject *args,
+        void **ff_args, const char **str_args)
+{
+    unsigned narg = type->ff_type->un.subprogram.narg;
+    Py_ssize_t argsize = 0;
     for (int i = 0 ; i < narg ; ++i)
     {
         ForeignTypeObject *arg_ftype = type->ff_argtypes[i];
+        PyObject *py_arg = PySequence_Fast_GET_ITEM(args, i);
         void *data_ptr = NULL;
-        if (arg_ftype->ft_getdataptr)
+        ff_args[i] = NULL;
+        ForeignTypeObject *ref_ftype = funproxy_reftype(type, i, py_arg);
+        if (ref_ftype)
+        {
+            // Room for the pointer and for the cell it points to, with the
+            // worst case padding added by funproxy_storeargs to align them
+            argsize += _Alignof(void *) - 1 + sizeof(void *) +
+                _Alignof(max_align_t) - 1 + UNIQTYPE_SIZE_IN_BYTES(ref_ftype->ft_type);
+            continue;
+        }
+        if ((PyUnicode_Check(py_arg) || PyBytes_Check(py_arg)) &&
+                ForeignBaseType_IsCharPointer(arg_ftype->ft_type))
+        {
+            // Strings given to char * parameters only live during the call
+            str_args[i] = funproxy_callscopedstring(py_arg);
+            if (!str_args[i]) return -1;
+            data_ptr = &str_args[i];
+            ff_args[i] = data_ptr;
+        }
+        else if (arg_ftype->ft_getdataptr)
         {
-            PyObject *py_arg = PySequence_Fast_GET_ITEM(args, i);
-
             data_ptr = arg_ftype->ft_getdataptr(py_arg, arg_ftype);
             ff_args[i] = data_ptr;
         }
@@ -283,38 +458,356 @@ static PyObject *funproxy_call(ProxyObject *self, PyObject *args, PyObject *kwds
          * stack space for storing it */
         if (!data_ptr) argsize += UNIQTYPE_SIZE_IN_BYTES(arg_ftype->ft_type);
     }
+    return argsize;
+}
 
-    char argvals[argsize];
+static void *funproxy_alignup(void *ptr, uintptr_t align)
+{
+    return (void *) (((uintptr_t) ptr + align - 1) & ~(align - 1));
+}
+
+// Second step of argument conversion: store the remaining arguments into
+// argvals, including the cells of ByRef arguments. Returns -1 on error.
+static int funproxy_storeargs(FunctionProxyTypeObject *type, PyObject *args,
+        void **ff_args, char *argvals)
+{
+    unsigned narg = type->ff_type->un.subprogram.narg;
     void *cur_arg = argvals;
     for (int i = 0 ; i < narg ; ++i)
     {
         ForeignTypeObject *arg_ftype = type->ff_argtypes[i];
-        if (arg_ftype->ft_getdataptr && ff_args[i]) continue;
+        if (ff_args[i]) continue;
 
         PyObject *py_arg = PySequence_Fast_GET_ITEM(args, i);
-        if (arg_ftype->ft_storeinto(py_arg, cur_arg, arg_ftype) < 0)
+        ForeignTypeObject *ref_ftype = funproxy_reftype(type, i, py_arg);
+        if (ref_ftype)
         {
-            return NULL;
+            // The pointer and the cell are read by the callee, align them
+            void **cell_ptr = funproxy_alignup(cur_arg, _Alignof(void *));
+            void *cell = funproxy_alignup(cell_ptr + 1, _Alignof(max_align_t));
+            PyObject *value = ((ByRefObject *) py_arg)->br_value;
+            if (!value || value == Py_None) memset(cell, 0, UNIQTYPE_SIZE_IN_BYTES(ref_ftype->ft_type));
+            else if (ref_ftype->ft_storeinto(value, cell, ref_ftype) < 0) return -1;
+            *cell_ptr = cell;
+            ff_args[i] = cell_ptr;
+            cur_arg = cell + UNIQTYPE_SIZE_IN_BYTES(ref_ftype->ft_type);
+            continue;
         }
+        if (arg_ftype->ft_storeinto(py_arg, cur_arg, arg_ftype) < 0) return -1;
         ff_args[i] = cur_arg;
         cur_arg += UNIQTYPE_SIZE_IN_BYTES(arg_ftype->ft_type);
     }
+    return 0;
+}
 
+static unsigned funproxy_retsize(FunctionProxyTypeObject *type)
+{
     const struct uniqtype *ret_type = type->ff_type->related[0].un.t.ptr;
-    ForeignTypeObject *ret_ftype = type->ff_rettype;
-
     unsigned retsize = UNIQTYPE_SIZE_IN_BYTES(ret_type);
     // Return values can be widened by libffi up to sizeof(ffi_arg)
     if (sizeof(ffi_arg) > retsize) retsize = sizeof(ffi_arg);
-    char retval[retsize];
-
-    ffi_call(type->ff_cif, self->p_ptr, retval, ff_args);
+    return retsize;
+}
 
+// If str_errors is not NULL, the char * result is decoded from UTF-8 with this
+// error handler instead of creating a proxy.
+static PyObject *funproxy_convertresult(FunctionProxyTypeObject *type, void *retval,
+        const char *str_errors)
+{
     // FIXME: On big-endian architectures, we need to shift retval pointer if
     // it has been widened by libffi. For the moment assume we are little-endian
+    if (str_errors)
+    {
+        const char *str = *(const char **) retval;
+        if (!str) Py_RETURN_NONE;
+        return PyUnicode_DecodeUTF8(str, strlen(str), str_errors);
+    }
+    ForeignTypeObject *ret_ftype = type->ff_rettype;
     return ret_ftype->ft_copyfrom(retval, ret_ftype);
 }
 
+// Call the foreign function. If str_errors is not NULL, the char * result is
+// decoded from UTF-8 with this error handler instead of creating a proxy.
+// When profiling, the time spent in each step is accumulated into the
+// profile entry of the function.
+static PyObject *funproxy_callimpl(ProxyObject *self, PyObject *args, const char *str_errors)
+{
+    FunctionProxyTypeObject *type = (FunctionProxyTypeObject *) Py_TYPE(self);
+    if (funproxy_checkargs(type, args) < 0) return NULL;
+
+    struct profile_entry *entry = NULL;
+    PyObject *entry_ref = NULL;
+    unsigned long long nballocs = 0, start = 0, marshalled = 0, called = 0;
+    if (Profile_Enabled())
+    {
+        entry_ref = Profile_GetEntry(self->p_ptr, NULL, &entry);
+        if (!entry_ref) return NULL;
+        nballocs = Profile_NbAllocs();
+        start = Profile_Now();
+    }
+
+    // TODO: Handle keywords arguments (need liballocs support)
+
+    // Using libffi to make calls is probably highly inefficient as some
+    // arguments will be pushed to the stack twice.
+    unsigned narg = type->ff_type->un.subprogram.narg;
+    void *ff_args[narg];
+    const char *str_args[narg];
+    Py_ssize_t argsize = funproxy_bindargs(type, args, ff_args, str_args);
+    if (argsize < 0)
+    {
+        Py_XDECREF(entry_ref);
+        return NULL;
+    }
+
+    char argvals[argsize];
+    if (funproxy_storeargs(type, args, ff_args, argvals) < 0)
+    {
+        Py_XDECREF(entry_ref);
+        return NULL;
+    }
+
+    char retval[funproxy_retsize(type)];
+    if (entry) marshalled = Profile_Now();
+    ffi_call(type->ff_cif, self->p_ptr, retval, ff_args);
+    if (entry) called = Profile_Now();
+
+    PyObject *result = funproxy_updaterefs(type, args, ff_args) < 0 ? NULL :
+        funproxy_convertresult(type, retval, str_errors);
+
+    if (entry)
+    {
+        unsigned long long converted = Profile_Now();
+        ++entry->pe_calls;
+        entry->pe_marshal_ns += marshalled - start;
+        entry->pe_call_ns += called - marshalled;
+        entry->pe_convert_ns += converted - called;
+        entry->pe_py_allocs += Profile_NbAllocs() - nballocs;
+        Py_DECREF(entry_ref);
+    }
+    return result;
+}
+
+static PyObject *funproxy_call(ProxyObject *self, PyObject *args, PyObject *kwds)
+{
+    return funproxy_callimpl(self, args, NULL);
+}
+
+// Foreign call started by acall. Its native arguments live in the same
+// allocation, right after the structure.
+struct funproxy_asynccall
+{
+    struct async_call fa_base;
+    ProxyObject *fa_function;
+    PyObject *fa_args; // Keeps alive the objects whose data is passed
+    void **fa_ffargs;
+    char *fa_argvals;
+    char *fa_retval;
+    // Profile entry of the function and counters of the steps done so far,
+    // only set if profiling was enabled when the call was started. Python
+    // allocations are only counted while converting on the calling thread.
+    PyObject *fa_profile;
+    struct profile_entry *fa_entry;
+    unsigned long long fa_marshal_ns;
+    unsigned long long fa_call_ns;
+    unsigned long long fa_py_allocs;
+};
+
+static void funproxy_asyncrun(struct async_call *call)
+{
+    struct funproxy_asynccall *fcall = (struct funproxy_asynccall *) call;
+    FunctionProxyTypeObject *type = (FunctionProxyTypeObject *) Py_TYPE(fcall->fa_function);
+    unsigned long long start = fcall->fa_entry ? Profile_Now() : 0;
+    ffi_call(type->ff_cif, fcall->fa_function->p_ptr, fcall->fa_retval, fcall->fa_ffargs);
+    if (fcall->fa_entry) fcall->fa_call_ns = Profile_Now() - start;
+}
+
+static PyObject *funproxy_asynccomplete(struct async_call *call)
+{
+    struct funproxy_asynccall *fcall = (struct funproxy_asynccall *) call;
+    FunctionProxyTypeObject *type = (FunctionProxyTypeObject *) Py_TYPE(fcall->fa_function);
+    struct profile_entry *entry = fcall->fa_entry;
+    unsigned long long nballocs = 0, start = 0;
+    if (entry)
+    {
+        nballocs = Profile_NbAllocs();
+        start = Profile_Now();
+    }
+
+    PyObject *result = funproxy_updaterefs(type, fcall->fa_args, fcall->fa_ffargs) < 0 ? NULL :
+        funproxy_convertresult(type, fcall->fa_retval, NULL);
+
+    if (entry)
+    {
+        ++entry->pe_calls;
+        entry->pe_marshal_ns += fcall->fa_marshal_ns;
+        entry->pe_call_ns += fcall->fa_call_ns;
+        entry->pe_convert_ns += Profile_Now() - start;
+        entry->pe_py_allocs += fcall->fa_py_allocs + Profile_NbAllocs() - nballocs;
+    }
+    return result;
+}
+
+static void funproxy_asyncfree(struct async_call *call)
+{
+    struct funproxy_asynccall *fcall = (struct funproxy_asynccall *) call;
+    Py_XDECREF(fcall->fa_profile);
+    Py_DECREF(fcall->fa_function);
+    Py_DECREF(fcall->fa_args);
+    PyMem_Free(fcall->fa_argvals);
+    PyMem_Free(fcall);
+}
+
+// Arguments are converted on the calling thread, then the foreign function
+// runs on a worker thread without the GIL. When profiling, each step is
+// accumulated into the profile entry of the function once the call completes.
+static PyObject *funproxy_acall(ProxyObject *self, PyObject *args)
+{
+    FunctionProxyTypeObject *type = (FunctionProxyTypeObject *) Py_TYPE(self);
+    if (funproxy_checkargs(type, args) < 0) return NULL;
+
+    struct profile_entry *entry = NULL;
+    PyObject *entry_ref = NULL;
+    unsigned long long nballocs = 0, start = 0;
+    if (Profile_Enabled())
+    {
+        entry_ref = Profile_GetEntry(self->p_ptr, NULL, &entry);
+        if (!entry_ref) return NULL;
+        nballocs = Profile_NbAllocs();
+        start = Profile_Now();
+    }
+
+    unsigned narg = type->ff_type->un.subprogram.narg;
+    struct funproxy_asynccall *fcall = PyMem_Malloc(sizeof(struct funproxy_asynccall) +
+            narg * (sizeof(void *) + sizeof(const char *)));
+    if (!fcall)
+    {
+        Py_XDECREF(entry_ref);
+        return PyErr_NoMemory();
+    }
+    fcall->fa_ffargs = (void **) (fcall + 1);
+    const char **str_args = (const char **) (fcall->fa_ffargs + narg);
+
+    Py_ssize_t argsize = funproxy_bindargs(type, args, fcall->fa_ffargs, str_args);
+    if (argsize < 0)
+    {
+        Py_XDECREF(entry_ref);
+        PyMem_Free(fcall);
+        return NULL;
+    }
+
+    fcall->fa_argvals = PyMem_Malloc(argsize + funproxy_retsize(type));
+    if (!fcall->fa_argvals)
+    {
+        Py_XDECREF(entry_ref);
+        PyMem_Free(fcall);
+        return PyErr_NoMemory();
+    }
+    fcall->fa_profile = entry_ref;
+    fcall->fa_entry = entry;
+    fcall->fa_call_ns = 0;
+    fcall->fa_retval = fcall->fa_argvals + argsize;
+    Py_INCREF(self);
+    fcall->fa_function = self;
+    Py_INCREF(args);
+    fcall->fa_args = args;
+    fcall->fa_base.ac_run = funproxy_asyncrun;
+    fcall->fa_base.ac_complete = funproxy_asynccomplete;
+    fcall->fa_base.ac_free = funproxy_asyncfree;
+
+    if (funproxy_storeargs(type, args, fcall->fa_ffargs, fcall->fa_argvals) < 0)
+    {
+        funproxy_asyncfree(&fcall->fa_base);
+        return NULL;
+    }
+    if (entry)
+    {
+        fcall->fa_marshal_ns = Profile_Now() - start;
+        fcall->fa_py_allocs = Profile_NbAllocs() - nballocs;
+    }
+    return AsyncCall_Submit(&fcall->fa_base);
+}
+
+typedef struct {
+    PyObject_HEAD
+    ProxyObject *sr_function;
+    PyObject *sr_errors;
+} StrResultFunctionObject;
+
+static PyObject *strresult_call(StrResultFunctionObject *self, PyObject *args, PyObject *kwds)
+{
+    const char *errors = PyUnicode_AsUTF8(self->sr_errors);
+    if (!errors) return NULL;
+    return funproxy_callimpl(self->sr_function, args, errors);
+}
+
+static PyObject *strresult_repr(StrResultFunctionObject *self)
+{
+    return PyUnicode_FromFormat("<str result of %R>", self->sr_function);
+}
+
+static void strresult_dealloc(StrResultFunctionObject *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+    Py_DECREF(self->sr_function);
+    Py_XDECREF(self->sr_errors);
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+static PyType_Slot strresult_slots[] = {
+    {Py_tp_doc, "Foreign function whose C string result is decoded to str"},
+    {Py_tp_call, strresult_call},
+    {Py_tp_repr, strresult_repr},
+    {Py_tp_dealloc, strresult_dealloc},
+    {0, NULL}
+};
+
+PyType_Spec StrResultFunction_TypeSpec = {
+    .name = "allocs.StrResultFunction",
+    .basicsize = sizeof(StrResultFunctionObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = strresult_slots,
+};
+
+static PyObject *funproxy_strresult(ProxyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *keywords[] = { "errors", NULL };
+    PyObject *errors = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|U", keywords, &errors)) return NULL;
+
+    const struct uniqtype *ret_type = ((FunctionProxyTypeObject *) Py_TYPE(self))->ff_type->related[0].un.t.ptr;
+    if (!ret_type || !ForeignBaseType_IsCharPointer(ret_type))
+    {
+        PyErr_SetString(PyExc_TypeError, "Only functions returning char * can decode their result");
+        return NULL;
+    }
+
+    StrResultFunctionObject *obj = PyObject_New(StrResultFunctionObject,
+            Allocs_GetState()->strresult_type);
+    if (!obj) return NULL;
+    Py_INCREF(self);
+    obj->sr_function = self;
+    obj->sr_errors = errors ? (Py_INCREF(errors), errors) : PyUnicode_FromString("strict");
+    if (!obj->sr_errors)
+    {
+        Py_DECREF(obj);
+        return NULL;
+    }
+    return (PyObject *) obj;
+}
+
+static PyMethodDef funproxy_methods[] = {
+    {"str_result", (PyCFunction) funproxy_strresult, METH_VARARGS | METH_KEYWORDS,
+        "Get a callable that calls this function and decodes its C string "
+        "result to str (None for NULL), without creating a proxy."},
+    {"acall", (PyCFunction) funproxy_acall, METH_VARARGS,
+        "Call this function on a worker thread without holding the GIL. "
+        "Returns a future of the running asyncio event loop. Arguments must "
+        "not be modified until the future completes."},
+    {NULL}
+};
+
 static PyObject *funproxy_repr(ProxyObject *self)
 {
     FunctionProxyTypeObject *proxytype = (FunctionProxyTypeObject *) Py_TYPE(self);
@@ -363,13 +856,9 @@ typedef struct {
 
 typedef void (*ffi_closure_func)(ffi_cif *, void *, void **, void*);
 
-static void closureproxy_call(ffi_cif *cif, void *ret, void **args, ClosureProxyObject *closure)
+static PyObject *closureproxy_convertargs(FunctionProxyTypeObject *fun_type,
+        void **args, unsigned nargs)
 {
-    // FIXME: Will break if subclassing (but what's the point in doing this anyway...)
-    FunctionProxyTypeObject *fun_type =
-        (FunctionProxyTypeObject *) Py_TYPE(closure)->tp_base;
-
-    unsigned nargs = cif->nargs;
     PyObject *pargs = PyTuple_New(nargs);
     for (unsigned i = 0; i < nargs; ++i)
     {
@@ -378,11 +867,52 @@ static void closureproxy_call(ffi_cif *cif, void *ret, void **args, ClosureProxy
         // the function call).
         PyTuple_SET_ITEM(pargs, i, arg_type->ft_copyfrom(args[i], arg_type));
     }
+    return pargs;
+}
+
+// When profiling, the time spent in each step is accumulated into the profile
+// entry of the closure
+static void closureproxy_call(ffi_cif *cif, void *ret, void **args, ClosureProxyObject *closure)
+{
+    // FIXME: Will break if subclassing (but what's the point in doing this anyway...)
+    FunctionProxyTypeObject *fun_type =
+        (FunctionProxyTypeObject *) Py_TYPE(closure)->tp_base;
+
+    // Foreign code can call us from a worker thread running an acall
+    struct python_entry py_entry;
+    AsyncCall_EnterPython(&py_entry);
+
+    struct profile_entry *entry = NULL;
+    PyObject *entry_ref = NULL;
+    unsigned long long nballocs = 0, start = 0, marshalled = 0, called = 0;
+    if (Profile_Enabled())
+    {
+        entry_ref = Profile_GetEntry(closure->ff_base.p_ptr, closure->fc_callable, &entry);
+        if (!entry_ref) PyErr_WriteUnraisable((PyObject *) closure);
+        nballocs = Profile_NbAllocs();
+        start = Profile_Now();
+    }
 
+    PyObject *pargs = closureproxy_convertargs(fun_type, args, cif->nargs);
+    if (entry) marshalled = Profile_Now();
     PyObject *ret_obj = PyObject_CallObject(closure->fc_callable, pargs);
+    if (entry) called = Profile_Now();
 
     ForeignTypeObject *ret_type = fun_type->ff_rettype;
     ret_type->ft_storeinto(ret_obj, ret, ret_type);
+
+    if (entry)
+    {
+        unsigned long long converted = Profile_Now();
+        ++entry->pe_calls;
+        entry->pe_marshal_ns += marshalled - start;
+        entry->pe_call_ns += called - marshalled;
+        entry->pe_convert_ns += converted - called;
+        entry->pe_py_allocs += Profile_NbAllocs() - nballocs;
+        Py_DECREF(entry_ref);
+    }
+
+    AsyncCall_LeavePython(&py_entry);
 }
 
 static PyObject *closureproxy_ctor(PyObject *args, PyObject *kwds, ForeignTypeObject *ftype)
@@ -475,9 +1005,11 @@ static PyTypeObject *funproxy_newproxytype(const struct uniqtype *type)
         .tp_base = &Proxy_Type,
         .tp_call = (ternaryfunc) funproxy_call,
         .tp_repr = (reprfunc) funproxy_repr,
+        .tp_methods = funproxy_methods,
     };
     htype->ff_type = type;
     htype->ff_cif = NULL;
+    htype->ff_reftypes = NULL;
 
     if (PyType_Ready((PyTypeObject *) htype) < 0)
     {
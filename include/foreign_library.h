@@ -6,8 +6,73 @@
 #include <stdbool.h>
 #include <minicrunch.h>
 
+// tracemalloc domain of the foreign memory owned by proxies
+#define ALLOCS_TRACEMALLOC_DOMAIN 0x616c6c63
+
 // All the functions declared here do not NULL check or typecheck their arguments
 
+// Limits applied when building the repr of foreign containers.
+// Negative values disable the corresponding limit.
+struct proxy_repr_limits
+{
+    Py_ssize_t max_items; // Items shown per container
+    Py_ssize_t max_depth; // Nesting level of containers shown
+    Py_ssize_t max_size;  // Characters written before truncating a container
+};
+
+// liballocs queries issued by the FFI. Every query is counted, its latency is
+// only measured while profiling is enabled.
+enum allocs_query
+{
+    QUERY_GET_ALLOC_INFO, // Proxy_GetOrCreateBase
+    QUERY_GET_ALLOC_TYPE, // Symbols of loaded libraries
+    QUERY_FETCH_BOUNDS, // Lengths of pointed arrays and strings
+    QUERY_ATTACH_POLICY, // Proxy_Register
+    QUERY_DETACH_POLICY, // Proxy_Unregister
+    NB_QUERIES
+};
+
+// Bucket i counts the queries that took less than 2^i ns (and at least
+// 2^(i-1) ns), the last one also counts longer queries
+#define QUERY_NB_BUCKETS 36
+struct query_stats
+{
+    unsigned long long qs_count;
+    unsigned long long qs_timed;
+    unsigned long long qs_total_ns;
+    unsigned long long qs_max_ns;
+    unsigned long long qs_buckets[QUERY_NB_BUCKETS];
+};
+
+// Registries, types and counters of the allocs module. There is one instance
+// per interpreter, stored in the module state, and only accessed with the GIL
+// of that interpreter held.
+typedef struct {
+    PyObject *proxy_dict; // Base proxies by address (weak references)
+    PyObject *proxy_pointing_addr_dict; // Proxies by address pointing to them
+    PyObject *type_dict; // Foreign types by uniqtype address
+    PyObject *async_queues; // Completion queues of acall by event loop
+    PyObject *get_running_loop; // asyncio.get_running_loop, imported by the first acall
+    PyObject *profile_entries; // Profiling counters by function address
+    PyObject *owned_allocs; // Sizes of the foreign chunks freed with their proxy
+    Py_ssize_t owned_bytes; // Total of owned_allocs
+    Py_ssize_t foreign_pressure; // Bytes allocated since the last forced collection
+    Py_ssize_t foreign_gc_threshold; // Forced collection threshold, 0 to disable
+    unsigned long foreign_gc_collections; // Number of forced collections
+    PyTypeObject *byref_type;
+    PyTypeObject *strresult_type;
+    PyTypeObject *foreignglobal_type;
+    PyTypeObject *asyncqueue_type;
+    bool creating_base; // Prevents recursion in Proxy_GetOrCreateBase
+    struct proxy_repr_limits repr_limits;
+    unsigned long nb_deferred_lengths; // Pointer proxies created without length
+    unsigned long nb_computed_lengths; // Those whose bounds were queried later
+    bool profile_enabled;
+    unsigned long long profile_nballocs; // Python allocations while profiling
+    struct query_stats query_stats[NB_QUERIES];
+} AllocsState;
+AllocsState *Allocs_GetState(void);
+
 typedef struct {
     PyObject_HEAD
     void *p_ptr;
@@ -45,6 +110,11 @@ typedef struct ForeignTypeObject {
     // given compatible object to the foreign type.
     int (*ft_storeinto)(PyObject *obj, void *dest, struct ForeignTypeObject *type);
 
+    // Store n objects into consecutive items of an array starting at dest,
+    // with the same semantics as calling ft_storeinto on each of them.
+    // Can be NULL, ft_storeinto is then used for each item.
+    int (*ft_storemany)(PyObject *const *items, Py_ssize_t n, void *dest, struct ForeignTypeObject *type);
+
     // Returns a pointer to an existing data chunk of the current type.
     // Return NULL on failure, but never set Python exception.
     // This field can be NULL if objects of this type never hold pointers to
@@ -63,9 +133,13 @@ extern PyTypeObject ForeignType_Type;
 
 ForeignTypeObject *ForeignType_GetOrCreate(const struct uniqtype *type);
 bool ForeignType_IsTriviallyCopiable(const ForeignTypeObject *type);
+bool ForeignType_ContainsPointers(const ForeignTypeObject *type);
+char *ForeignType_BufferFormat(const struct uniqtype *type);
 
 void Proxy_InitGCPolicy();
 void Proxy_Register(ProxyObject *proxy);
+void Proxy_RegisterOwned(ProxyObject *proxy, size_t size);
+void Proxy_ForeignAllocPressure(size_t size);
 void Proxy_Unregister(ProxyObject *proxy);
 ProxyObject *Proxy_GetOrCreateBase(void *addr);
 void Proxy_AddRefTo(ProxyObject *target_proxy, const void **from);
@@ -76,23 +150,106 @@ void *Proxy_GetDataPtr(PyObject *obj, ForeignTypeObject *type);
 int Proxy_ClearRef(PyObject *obj, void *arg);
 int Proxy_TraverseRef(void *data, visitproc visit, void *arg, ForeignTypeObject *type);
 ForeignTypeObject *Proxy_NewType(const struct uniqtype *type, PyTypeObject *proxytype);
+PyObject *Proxy_ReduceEx(PyObject *obj, ForeignTypeObject *type, int protocol);
+
+bool Proxy_ReprTooDeep(void);
+int Proxy_ReprTruncate(_PyUnicodeWriter *writer, Py_ssize_t index);
+int Proxy_ReprItem(_PyUnicodeWriter *writer, Py_ssize_t index, const char *name, PyObject *item);
+
+// A foreign call run on a worker thread and completed on an asyncio loop
+struct async_call
+{
+    struct async_call *ac_next;
+    // Run on a worker thread, without holding the GIL
+    void (*ac_run)(struct async_call *call);
+    // Run on the event loop thread once ac_run is finished. Returns the
+    // result of the call, or NULL with an exception set.
+    PyObject *(*ac_complete)(struct async_call *call);
+    // Release the memory and references owned by the call
+    void (*ac_free)(struct async_call *call);
+    PyObject *ac_future;
+    PyObject *ac_queue;
+    PyInterpreterState *ac_interp;
+};
+extern PyType_Spec AsyncQueue_TypeSpec;
+PyObject *AsyncCall_Submit(struct async_call *call);
+PyObject *AsyncCall_Workers(PyObject *nbworkers);
+
+struct python_entry
+{
+    PyThreadState *tstate;
+    PyGILState_STATE gilstate;
+    bool ensured;
+};
+void AsyncCall_EnterPython(struct python_entry *entry);
+void AsyncCall_LeavePython(struct python_entry *entry);
+
+// Counters of the calls to a foreign function or closure, accumulated while
+// profiling is enabled
+struct profile_entry
+{
+    void *pe_addr;
+    PyObject *pe_callable; // Called by closures, NULL for foreign functions
+    unsigned long long pe_calls;
+    unsigned long long pe_marshal_ns; // Converting arguments
+    unsigned long long pe_call_ns; // Running the callee
+    unsigned long long pe_convert_ns; // Converting the return value
+    unsigned long long pe_py_allocs; // Blocks from the Python allocators
+};
+bool Profile_Enabled(void);
+unsigned long long Profile_Now(void);
+unsigned long long Profile_NbAllocs(void);
+PyObject *Profile_GetEntry(void *addr, PyObject *callable, struct profile_entry **entry);
+PyObject *Profile_Set(int enable);
+void Profile_Reset(void);
+PyObject *Profile_Stats(const char *sort_key);
+
+void Query_Record(enum allocs_query query, unsigned long long duration);
+PyObject *Query_GetStats(bool reset);
+
+// Surround each liballocs query with Query_Begin and Query_End. Queries made
+// from liballocs callbacks in interpreters without allocs are not counted.
+static inline unsigned long long Query_Begin(enum allocs_query query)
+{
+    AllocsState *state = Allocs_GetState();
+    if (!state) return 0;
+    ++state->query_stats[query].qs_count;
+    return state->profile_enabled ? Profile_Now() : 0;
+}
+
+static inline void Query_End(enum allocs_query query, unsigned long long start)
+{
+    if (start) Query_Record(query, Profile_Now() - start);
+}
 
 extern PyTypeObject LibraryLoader_Type;
+extern PyType_Spec ForeignGlobal_TypeSpec;
 
 ForeignTypeObject *ForeignBaseType_New(const struct uniqtype *type);
 bool ForeignBaseType_IsChar(const struct uniqtype *type);
+bool ForeignBaseType_IsCharPointer(const struct uniqtype *type);
+bool ForeignBaseType_IsInteger(const struct uniqtype *type);
+Py_ssize_t ForeignBaseType_ReadLength(const void *data, const struct uniqtype *type);
+const char *ForeignBaseType_FormatCode(const struct uniqtype *type, bool native);
 
 extern PyTypeObject FunctionProxy_Metatype;
+extern PyType_Spec StrResultFunction_TypeSpec;
+extern PyType_Spec ByRef_TypeSpec;
 ForeignTypeObject *FunctionProxy_NewType(const struct uniqtype *type);
 
 extern PyTypeObject CompositeProxy_Metatype;
 ForeignTypeObject *CompositeProxy_NewType(const struct uniqtype *type);
 void CompositeProxy_InitType(ForeignTypeObject *self, const struct uniqtype *type);
+int CompositeProxy_BindLength(ForeignTypeObject *self, const char *field, const char *length_field);
 
 extern PyTypeObject AddressProxy_Metatype;
 ForeignTypeObject *AddressProxy_NewType(const struct uniqtype *type);
 void AddressProxy_InitType(ForeignTypeObject *self, const struct uniqtype *type);
+PyObject *AddressProxy_LengthStats(void);
+PyObject *AddressProxy_GetFromWithLength(void *data, ForeignTypeObject *type, Py_ssize_t length);
 ForeignTypeObject *ArrayProxy_NewType(const struct uniqtype *type);
 void ArrayProxy_InitType(ForeignTypeObject *self, const struct uniqtype *type);
+int ArrayProxy_TraverseWithLength(void *data, Py_ssize_t length, visitproc visit,
+        void *arg, ForeignTypeObject *type);
 
 #endif
@@ -1,5 +1,7 @@
 #include <liballocs.h>
 
+// The extension links against liballocs: keep these symbols private to it
+#pragma GCC visibility push(hidden)
 
 typedef struct {
     unsigned long base;
@@ -24,4 +26,26 @@ static _Bool bounds_cb(struct uniqtype *u, struct uniqtype_containment_ctxt *ucc
 	unsigned u_offset_from_search_start, void *arg_void);
 
 
-Bounds __fetch_bounds_internal(const void *obj, const void *derived, const struct uniqtype *t);
\ No newline at end of file
+/* Bounds of the array of t around obj, answered from the bounds cache when
+ * the allocation has not changed since they were computed. Checking this
+ * takes an alloc info query, cache hits only save the subobject search. */
+Bounds __minicrunch_fetch_bounds(const void *obj, const void *derived, const struct uniqtype *t);
+
+struct bounds_cache_stats
+{
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long invalidations;
+};
+
+/* Forget cached bounds inside the allocation starting at alloc_start.
+ * Stale entries are also detected on lookup, this only frees their slots. */
+void __minicrunch_bounds_cache_invalidate(const void *alloc_start);
+void __minicrunch_bounds_cache_flush(void);
+struct bounds_cache_stats __minicrunch_bounds_cache_stats(void);
+
+/* Compare the flattened subobject index with the subobject walk of liballocs
+ * on every offset of u. Returns the number of differing answers. */
+unsigned long __minicrunch_check_subobj_index(const struct uniqtype *u, unsigned long *checked);
+
+#pragma GCC visibility pop
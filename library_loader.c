@@ -48,12 +48,133 @@ static int dl_iterate_syms(struct link_map *handle,
     return ret;
 }
 
+// Descriptor giving live access to a global variable of a foreign library.
+// Each access reads or writes the storage of the symbol directly.
+typedef struct {
+    PyObject_HEAD
+    void *fg_data;
+    ForeignTypeObject *fg_type;
+    PyObject *fg_name;
+    bool fg_readonly; // Stored in a segment mapped without write permission
+} ForeignGlobalObject;
+
+static void foreignglobal_dealloc(ForeignGlobalObject *self)
+{
+    PyTypeObject *type = Py_TYPE(self);
+    Py_DECREF(self->fg_type);
+    Py_DECREF(self->fg_name);
+    type->tp_free((PyObject *) self);
+    Py_DECREF(type);
+}
+
+static PyObject *foreignglobal_get(ForeignGlobalObject *self, PyObject *obj, PyObject *type)
+{
+    if (!obj)
+    {
+        Py_INCREF(self);
+        return (PyObject *) self;
+    }
+    return self->fg_type->ft_getfrom(self->fg_data, self->fg_type);
+}
+
+static int foreignglobal_set(ForeignGlobalObject *self, PyObject *obj, PyObject *value)
+{
+    if (!value)
+    {
+        PyErr_Format(PyExc_AttributeError, "Cannot delete foreign global '%U'", self->fg_name);
+        return -1;
+    }
+    if (self->fg_readonly)
+    {
+        PyErr_Format(PyExc_AttributeError, "Cannot assign read-only foreign global '%U'",
+                self->fg_name);
+        return -1;
+    }
+    return self->fg_type->ft_storeinto(value, self->fg_data, self->fg_type);
+}
+
+static PyObject *foreignglobal_repr(ForeignGlobalObject *self)
+{
+    return PyUnicode_FromFormat("<foreign global '%U' of type '%s'>", self->fg_name,
+            UNIQTYPE_NAME(self->fg_type->ft_type));
+}
+
+static PyType_Slot foreignglobal_slots[] = {
+    {Py_tp_doc, "Live access to a global variable of a foreign library"},
+    {Py_tp_dealloc, foreignglobal_dealloc},
+    {Py_tp_repr, foreignglobal_repr},
+    {Py_tp_descr_get, foreignglobal_get},
+    {Py_tp_descr_set, foreignglobal_set},
+    {0, NULL}
+};
+
+PyType_Spec ForeignGlobal_TypeSpec = {
+    .name = "allocs.ForeignGlobal",
+    .basicsize = sizeof(ForeignGlobalObject),
+    .flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+    .slots = foreignglobal_slots,
+};
+
+struct writable_ctxt
+{
+    ElfW(Addr) load_address;
+    ElfW(Addr) addr;
+    bool writable;
+};
+
+static int find_writable_segment(struct dl_phdr_info *info, size_t size, void *arg)
+{
+    struct writable_ctxt *ctxt = arg;
+    if (info->dlpi_addr != ctxt->load_address) return 0;
+
+    bool found = false;
+    for (unsigned i = 0; i < info->dlpi_phnum; ++i)
+    {
+        const ElfW(Phdr) *phdr = &info->dlpi_phdr[i];
+        ElfW(Addr) begin = info->dlpi_addr + phdr->p_vaddr;
+        if (ctxt->addr < begin || ctxt->addr >= begin + phdr->p_memsz) continue;
+        if (phdr->p_type == PT_LOAD)
+        {
+            found = true;
+            ctxt->writable = ctxt->writable || (phdr->p_flags & PF_W);
+        }
+        else if (phdr->p_type == PT_GNU_RELRO)
+        {
+            // Constants needing relocations are made read-only after them
+            ctxt->writable = false;
+            return 1;
+        }
+    }
+    return found;
+}
+
+// Check if the storage of a symbol of the library loaded at load_address is
+// mapped writable, from the flags of the segment holding it
+static bool is_writable_symbol(ElfW(Addr) load_address, const void *data)
+{
+    struct writable_ctxt ctxt = {
+        .load_address = load_address,
+        .addr = (ElfW(Addr)) data,
+        .writable = false,
+    };
+    dl_iterate_phdr(find_writable_segment, &ctxt);
+    return ctxt.writable;
+}
+
 struct add_sym_ctxt
 {
     PyObject *module;
     LibraryLoaderObject *loader;
+    PyObject *globals; // Descriptors for the module class
 };
 
+// Scalar and pointer values are copied when decoded, so they would become
+// stale snapshots if stored as plain module attributes
+static bool is_live_global_type(const struct uniqtype *type)
+{
+    return UNIQTYPE_IS_BASE_TYPE(type) || UNIQTYPE_IS_POINTER_TYPE(type);
+}
+
 static int add_type_to_module(const struct uniqtype *type, struct add_sym_ctxt* ctxt)
 {
     // FIXME: For many types these names will feel very weird
@@ -144,7 +265,9 @@ static int add_sym_to_module(const ElfW(Sym) *sym, ElfW(Addr) loadAddress,
 
         void *data = (void *)(loadAddress + sym->st_value);
 
+        unsigned long long start = Query_Begin(QUERY_GET_ALLOC_TYPE);
         const struct uniqtype *type = __liballocs_get_alloc_type(data);
+        Query_End(QUERY_GET_ALLOC_TYPE, start);
         if (!type) return 0;
         recursively_add_useful_types(type, ctxt);
 
@@ -155,6 +278,31 @@ static int add_sym_to_module(const ElfW(Sym) *sym, ElfW(Addr) loadAddress,
             return 0;
         }
 
+        if (ELF64_ST_TYPE(sym->st_info) == STT_OBJECT && is_live_global_type(type))
+        {
+            ForeignGlobalObject *global = PyObject_New(ForeignGlobalObject,
+                    Allocs_GetState()->foreignglobal_type);
+            if (global)
+            {
+                global->fg_data = data;
+                global->fg_type = ftype; // Steals reference
+                global->fg_name = PyUnicode_FromString(symname);
+                global->fg_readonly = !is_writable_symbol(loadAddress, data);
+                if (!global->fg_name ||
+                        PyDict_SetItem(ctxt->globals, global->fg_name, (PyObject *) global) < 0)
+                {
+                    PyErr_Clear();
+                }
+                Py_DECREF(global);
+            }
+            else
+            {
+                Py_DECREF(ftype);
+                PyErr_Clear();
+            }
+            return 0;
+        }
+
         PyObject *obj = ftype->ft_getfrom(data, ftype);
         Py_DECREF(ftype);
         if (!obj)
@@ -179,8 +327,32 @@ static PyObject *libloader_exec(LibraryLoaderObject *self, PyObject *module)
     struct add_sym_ctxt ctxt;
     ctxt.module = module;
     ctxt.loader = self;
+    ctxt.globals = PyDict_New();
+    if (!ctxt.globals) return NULL;
 
     dl_iterate_syms(self->dl_handle, add_sym_to_module, &ctxt);
+
+    // Global variables are descriptors of a module subclass specific to
+    // this library
+    if (PyDict_Size(ctxt.globals))
+    {
+        PyObject *modtype = NULL;
+        PyObject *modname = PyModule_GetNameObject(module);
+        if (modname && PyDict_SetItemString(ctxt.globals, "__module__", modname) == 0)
+        {
+            modtype = PyObject_CallFunction((PyObject *) &PyType_Type, "s(O)O",
+                    "ForeignLibrary", &PyModule_Type, ctxt.globals);
+        }
+        Py_XDECREF(modname);
+        if (!modtype || PyObject_SetAttrString(module, "__class__", modtype) < 0)
+        {
+            Py_XDECREF(modtype);
+            Py_DECREF(ctxt.globals);
+            return NULL;
+        }
+        Py_DECREF(modtype);
+    }
+    Py_DECREF(ctxt.globals);
     Py_RETURN_NONE;
 }
 
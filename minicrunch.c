@@ -4,6 +4,8 @@
 #endif
 
 #include <stddef.h>
+#include <stdlib.h>
+#include <pthread.h>
 #include "liballocs.h"
 #include "liballocs_private.h"
 #include <limits.h>
@@ -101,7 +103,6 @@ static _Bool bounds_cb(struct uniqtype *u, struct uniqtype_containment_ctxt *ucc
 		assert(u->pos_maxoff == arg->passed_in_t->pos_maxoff);
 		arg->success = 1;
 		arg->matched_t = u;
-		cache_containment_facts(u, ucc);
 
 		return 1;
 	}
@@ -110,7 +111,395 @@ static _Bool bounds_cb(struct uniqtype *u, struct uniqtype_containment_ctxt *ucc
 	__builtin_unreachable();
 }
 
-Bounds __make_bounds(unsigned long base, unsigned long limit)
+/* Lookup-side bounds cache.
+ * Each entry covers a range of objects of type t, starting every period
+ * bytes from base + offset. When several entries match a query, the deepest
+ * one wins, as the slow path returns the innermost containing array.
+ * Entries remember the allocation they were computed for. Hits are only
+ * trusted if liballocs still reports the same allocation, so that memory
+ * freed and reused by foreign code is never answered from the cache. A hit
+ * therefore still costs an alloc info query, it only saves the subobject
+ * search.
+ * The cache is shared by all threads and protected by bounds_cache_lock. */
+#define BOUNDS_CACHE_SIZE 16
+
+struct bounds_cache_alloc
+{
+    const void *start;
+    unsigned long size;
+    const struct uniqtype *t;
+};
+
+struct bounds_cache_entry
+{
+    struct bounds_cache_alloc alloc;
+    const char *base;
+    const char *limit;
+    unsigned period;
+    unsigned offset;
+    const struct uniqtype *t;
+    unsigned short depth;
+};
+
+static pthread_mutex_t bounds_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bounds_cache_entry bounds_cache[BOUNDS_CACHE_SIZE];
+static unsigned bounds_cache_next;
+static struct bounds_cache_stats bounds_cache_stats;
+
+/* Copy the best entry matching obj inside alloc into *found. Returns 0 if
+ * there is none. Matching entries computed for another allocation are
+ * dropped. Hits and misses are counted under the same lock. */
+static _Bool bounds_cache_lookup(const void *obj, const struct uniqtype *t,
+        const struct bounds_cache_alloc *alloc, struct bounds_cache_entry *found)
+{
+    _Bool any = 0;
+    pthread_mutex_lock(&bounds_cache_lock);
+    for (unsigned i = 0; i < BOUNDS_CACHE_SIZE; ++i)
+    {
+        struct bounds_cache_entry *e = &bounds_cache[i];
+        if (!e->alloc.start || e->t != t) continue;
+        if ((const char *) obj < e->base || (const char *) obj >= e->limit) continue;
+        if (e->alloc.start != alloc->start || e->alloc.size != alloc->size
+                || e->alloc.t != alloc->t)
+        {
+            e->alloc.start = NULL;
+            ++bounds_cache_stats.invalidations;
+            continue;
+        }
+        unsigned long pos = (const char *) obj - e->base;
+        if (pos < e->offset) continue;
+        if (e->period ? (pos - e->offset) % e->period != 0 : pos != e->offset) continue;
+        if (!any || e->depth > found->depth) *found = *e;
+        any = 1;
+    }
+    if (any) ++bounds_cache_stats.hits;
+    else ++bounds_cache_stats.misses;
+    pthread_mutex_unlock(&bounds_cache_lock);
+    return any;
+}
+
+static void bounds_cache_insert(const struct bounds_cache_alloc *alloc, const void *base,
+        const void *limit, unsigned period, unsigned offset, const struct uniqtype *t,
+        unsigned short depth)
+{
+    pthread_mutex_lock(&bounds_cache_lock);
+    /* Round robin replacement */
+    bounds_cache[bounds_cache_next] = (struct bounds_cache_entry) {
+        .alloc = *alloc,
+        .base = base,
+        .limit = limit,
+        .period = period,
+        .offset = offset,
+        .t = t,
+        .depth = depth
+    };
+    bounds_cache_next = (bounds_cache_next + 1) % BOUNDS_CACHE_SIZE;
+    pthread_mutex_unlock(&bounds_cache_lock);
+}
+
+void __minicrunch_bounds_cache_invalidate(const void *alloc_start)
+{
+    pthread_mutex_lock(&bounds_cache_lock);
+    for (unsigned i = 0; i < BOUNDS_CACHE_SIZE; ++i)
+    {
+        if (bounds_cache[i].alloc.start == alloc_start)
+        {
+            bounds_cache[i].alloc.start = NULL;
+            ++bounds_cache_stats.invalidations;
+        }
+    }
+    pthread_mutex_unlock(&bounds_cache_lock);
+}
+
+void __minicrunch_bounds_cache_flush(void)
+{
+    pthread_mutex_lock(&bounds_cache_lock);
+    for (unsigned i = 0; i < BOUNDS_CACHE_SIZE; ++i) bounds_cache[i].alloc.start = NULL;
+    pthread_mutex_unlock(&bounds_cache_lock);
+}
+
+struct bounds_cache_stats __minicrunch_bounds_cache_stats(void)
+{
+    pthread_mutex_lock(&bounds_cache_lock);
+    struct bounds_cache_stats stats = bounds_cache_stats;
+    pthread_mutex_unlock(&bounds_cache_lock);
+    return stats;
+}
+
+/* Flattened subobject index.
+ * For each composite uniqtype, lists every subobject reachable without going
+ * through an array, in containment pre-order, which is also offset order as
+ * long as members do not overlap. Arrays are leaves: queries inside them
+ * descend into the element type by taking the offset modulo the element
+ * size. Indexes are built on first use and shared by all queries.
+ * Types with overlapping members (unions, bitfields) are not indexed and use
+ * the bounds_cb walk instead.
+ * The table of indexes is protected by subobj_indexes_lock. Indexes are never
+ * modified nor freed once built, and can be read without holding it. */
+struct subobj_index_entry
+{
+    unsigned offset;
+    unsigned size;
+    const struct uniqtype *t;
+    int parent; /* Closest enclosing entry, -1 for direct members */
+};
+
+struct subobj_index
+{
+    unsigned nb_entries;
+    struct subobj_index_entry entries[];
+};
+
+#define SUBOBJ_INDEX_UNAVAILABLE ((struct subobj_index *) -1)
+
+struct subobj_index_slot
+{
+    const struct uniqtype *t;
+    struct subobj_index *index;
+};
+
+static pthread_mutex_t subobj_indexes_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct subobj_index_slot *subobj_indexes;
+static unsigned subobj_indexes_cap;
+static unsigned subobj_indexes_count;
+
+static _Bool subobj_index_add_members(struct subobj_index **index, unsigned *cap,
+        const struct uniqtype *u, unsigned base, int parent)
+{
+    if (!UNIQTYPE_IS_COMPOSITE_TYPE(u)) return 1;
+    if (u->un.composite.not_simultaneous) return 0;
+
+    unsigned prev_end = base;
+    for (unsigned i = 0; i < UNIQTYPE_COMPOSITE_MEMBER_COUNT(u); ++i)
+    {
+        const struct uniqtype *mt = u->related[i].un.memb.ptr;
+        unsigned off = base + u->related[i].un.memb.off;
+        if (!mt || off < prev_end) return 0;
+        prev_end = UNIQTYPE_HAS_KNOWN_LENGTH(mt) ? off + mt->pos_maxoff : UINT_MAX;
+
+        if ((*index)->nb_entries == *cap)
+        {
+            *cap *= 2;
+            struct subobj_index *grown = realloc(*index,
+                sizeof(struct subobj_index) + *cap * sizeof(struct subobj_index_entry));
+            if (!grown) return 0;
+            *index = grown;
+        }
+        int pos = (*index)->nb_entries++;
+        (*index)->entries[pos] = (struct subobj_index_entry) {
+            .offset = off,
+            .size = mt->pos_maxoff,
+            .t = mt,
+            .parent = parent
+        };
+        if (!UNIQTYPE_IS_ARRAY_TYPE(mt) && !subobj_index_add_members(index, cap, mt, off, pos))
+            return 0;
+    }
+    return 1;
+}
+
+static struct subobj_index *subobj_index_build(const struct uniqtype *u)
+{
+    unsigned cap = 8;
+    struct subobj_index *index = malloc(sizeof(struct subobj_index) + cap * sizeof(struct subobj_index_entry));
+    if (!index) return SUBOBJ_INDEX_UNAVAILABLE;
+    index->nb_entries = 0;
+    if (!subobj_index_add_members(&index, &cap, u, 0, -1))
+    {
+        free(index);
+        return SUBOBJ_INDEX_UNAVAILABLE;
+    }
+    return index;
+}
+
+static struct subobj_index *subobj_index_get(const struct uniqtype *u)
+{
+    pthread_mutex_lock(&subobj_indexes_lock);
+    if (subobj_indexes_count * 2 >= subobj_indexes_cap)
+    {
+        /* Grow the open addressing table and rehash */
+        unsigned new_cap = subobj_indexes_cap ? 2 * subobj_indexes_cap : 64;
+        struct subobj_index_slot *slots = calloc(new_cap, sizeof(struct subobj_index_slot));
+        if (!slots)
+        {
+            pthread_mutex_unlock(&subobj_indexes_lock);
+            return SUBOBJ_INDEX_UNAVAILABLE;
+        }
+        for (unsigned i = 0; i < subobj_indexes_cap; ++i)
+        {
+            if (!subobj_indexes[i].t) continue;
+            unsigned h = ((unsigned long) subobj_indexes[i].t >> 4) & (new_cap - 1);
+            while (slots[h].t) h = (h + 1) & (new_cap - 1);
+            slots[h] = subobj_indexes[i];
+        }
+        free(subobj_indexes);
+        subobj_indexes = slots;
+        subobj_indexes_cap = new_cap;
+    }
+
+    unsigned h = ((unsigned long) u >> 4) & (subobj_indexes_cap - 1);
+    while (subobj_indexes[h].t && subobj_indexes[h].t != u) h = (h + 1) & (subobj_indexes_cap - 1);
+    if (!subobj_indexes[h].t)
+    {
+        subobj_indexes[h].t = u;
+        subobj_indexes[h].index = subobj_index_build(u);
+        ++subobj_indexes_count;
+    }
+    struct subobj_index *index = subobj_indexes[h].index;
+    pthread_mutex_unlock(&subobj_indexes_lock);
+    return index;
+}
+
+/* Find the same subobject as the bounds_cb walk, using the flattened indexes.
+ * Returns 0 if the index cannot answer, in which case the walk must be used. */
+static _Bool subobj_index_lookup(const struct uniqtype *u, unsigned target, struct bounds_cb_arg *arg)
+{
+    unsigned wanted = arg->passed_in_t->pos_maxoff;
+    unsigned base = 0; /* Offset of u from the search start */
+    /* Outermost array of the chain of directly nested arrays being descended,
+     * and the product of their lengths, as accumulated by bounds_cb */
+    const struct uniqtype *outermost = NULL;
+    unsigned outermost_off = 0;
+    size_t accum = 0;
+    while (1)
+    {
+        if (UNIQTYPE_IS_ARRAY_TYPE(u))
+        {
+            const struct uniqtype *elem = UNIQTYPE_ARRAY_ELEMENT_TYPE(u);
+            if (!elem || elem->pos_maxoff == 0 || !UNIQTYPE_HAS_KNOWN_LENGTH(elem)) return 0;
+            unsigned i = (target - base) / elem->pos_maxoff;
+            if (UNIQTYPE_HAS_KNOWN_LENGTH(u) && i >= UNIQTYPE_ARRAY_LENGTH(u)) return 0;
+            unsigned elem_off = base + i * elem->pos_maxoff;
+            if (!outermost)
+            {
+                outermost = u;
+                outermost_off = base;
+                accum = UNIQTYPE_ARRAY_LENGTH(u) < 1 ? 0 : UNIQTYPE_ARRAY_LENGTH(u);
+            }
+            else accum *= UNIQTYPE_ARRAY_LENGTH(u);
+            if (elem_off == target && elem->pos_maxoff == wanted)
+            {
+                arg->success = 1;
+                arg->matched_t = elem;
+                arg->innermost_containing_array_t = u;
+                arg->innermost_containing_array_type_span_start_offset = base;
+                arg->outermost_containing_array_t = outermost;
+                arg->outermost_containing_array_type_span_start_offset = outermost_off;
+                arg->accum_array_bounds = accum;
+                return 1;
+            }
+            u = elem;
+            base = elem_off;
+            continue;
+        }
+        /* Descending through a non-array ends the chain of nested arrays */
+        outermost = NULL;
+        outermost_off = 0;
+        accum = 0;
+
+        if (!UNIQTYPE_IS_COMPOSITE_TYPE(u)) return 0;
+        struct subobj_index *index = subobj_index_get(u);
+        if (index == SUBOBJ_INDEX_UNAVAILABLE) return 0;
+        unsigned rel = target - base;
+
+        /* Binary search the last entry starting at or before rel */
+        int lo = 0, hi = index->nb_entries;
+        while (lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if (index->entries[mid].offset <= rel) lo = mid + 1;
+            else hi = mid;
+        }
+        /* Climb to the innermost entry spanning rel */
+        int e = lo - 1;
+        while (e >= 0 && rel - index->entries[e].offset >= index->entries[e].size)
+            e = index->entries[e].parent;
+        if (e < 0) return 0;
+
+        /* In pre-order, the outermost entry starting at rel is visited first */
+        int match = -1;
+        for (int c = e; c >= 0 && index->entries[c].offset == rel; c = index->entries[c].parent)
+        {
+            if (index->entries[c].size == wanted) match = c;
+        }
+        if (match >= 0)
+        {
+            /* Entries are never directly contained in an array */
+            arg->success = 1;
+            arg->matched_t = index->entries[match].t;
+            arg->innermost_containing_array_t = NULL;
+            arg->innermost_containing_array_type_span_start_offset = 0;
+            arg->outermost_containing_array_t = NULL;
+            arg->outermost_containing_array_type_span_start_offset = 0;
+            arg->accum_array_bounds = 0;
+            return 1;
+        }
+        if (!UNIQTYPE_IS_ARRAY_TYPE(index->entries[e].t)) return 0;
+        base += index->entries[e].offset;
+        u = index->entries[e].t;
+    }
+}
+
+/* Check the index against the bounds_cb walk, for every offset inside u and
+ * every type of subobject found in u. Returns the number of lookups answered
+ * differently and stores in *checked the number of lookups the index answered. */
+#define SUBOBJ_CHECK_MAX_TYPES 64
+
+static void subobj_check_collect(const struct uniqtype *u, const struct uniqtype **types, unsigned *n)
+{
+    if (!u) return;
+    for (unsigned i = 0; i < *n; ++i) if (types[i] == u) return;
+    if (*n == SUBOBJ_CHECK_MAX_TYPES) return;
+    if (u->pos_maxoff > 0 && UNIQTYPE_HAS_KNOWN_LENGTH(u)) types[(*n)++] = u;
+
+    if (UNIQTYPE_IS_ARRAY_TYPE(u)) subobj_check_collect(UNIQTYPE_ARRAY_ELEMENT_TYPE(u), types, n);
+    else if (UNIQTYPE_IS_COMPOSITE_TYPE(u))
+    {
+        for (unsigned i = 0; i < UNIQTYPE_COMPOSITE_MEMBER_COUNT(u); ++i)
+            subobj_check_collect(u->related[i].un.memb.ptr, types, n);
+    }
+}
+
+unsigned long __minicrunch_check_subobj_index(const struct uniqtype *u, unsigned long *checked)
+{
+    const struct uniqtype *types[SUBOBJ_CHECK_MAX_TYPES];
+    unsigned nb_types = 0;
+    subobj_check_collect(u, types, &nb_types);
+
+    unsigned long mismatches = 0;
+    *checked = 0;
+    if (!UNIQTYPE_HAS_KNOWN_LENGTH(u)) return 0;
+    for (unsigned off = 0; off < u->pos_maxoff; ++off)
+    {
+        for (unsigned i = 0; i < nb_types; ++i)
+        {
+            struct bounds_cb_arg indexed = { .passed_in_t = types[i], .target_offset = off };
+            if (!subobj_index_lookup(u, off, &indexed)) continue;
+            ++*checked;
+
+            struct bounds_cb_arg walked = { .passed_in_t = types[i], .target_offset = off };
+            __liballocs_search_subobjects_spanning((struct uniqtype *) u, off, bounds_cb,
+                    &walked, NULL, NULL);
+            if (indexed.success != walked.success
+                    || indexed.matched_t != walked.matched_t
+                    || indexed.innermost_containing_array_t != walked.innermost_containing_array_t
+                    || indexed.innermost_containing_array_type_span_start_offset
+                        != walked.innermost_containing_array_type_span_start_offset
+                    || indexed.outermost_containing_array_t != walked.outermost_containing_array_t
+                    || indexed.outermost_containing_array_type_span_start_offset
+                        != walked.outermost_containing_array_type_span_start_offset
+                    || indexed.accum_array_bounds != walked.accum_array_bounds)
+            {
+                debug_println(1, "minicrunch: subobject index mismatch for %s at offset %u in %s",
+                        NAME_FOR_UNIQTYPE(types[i]), off, NAME_FOR_UNIQTYPE(u));
+                ++mismatches;
+            }
+        }
+    }
+    return mismatches;
+}
+
+static Bounds __make_bounds(unsigned long base, unsigned long limit)
 {
     Bounds b = {
         .base = base,
@@ -118,7 +507,7 @@ Bounds __make_bounds(unsigned long base, unsigned long limit)
     return b;
 }
 
-Bounds __fetch_bounds_internal(const void *obj, const void *derived, const struct uniqtype *t)
+Bounds __minicrunch_fetch_bounds(const void *obj, const void *derived, const struct uniqtype *t)
 {
     if (!obj)
         goto return_min_bounds;
@@ -139,6 +528,19 @@ Bounds __fetch_bounds_internal(const void *obj, const void *derived, const struc
     if (__builtin_expect(err != NULL, 0))
         goto out; /* liballocs has already counted this abort */
 
+    // CACHE LOOKUP
+    /* The allocation info is cheap compared to the subobject search. Only
+     * trust the cached bounds if they were computed for this allocation. */
+    struct bounds_cache_alloc alloc = {
+        .start = alloc_start,
+        .size = alloc_size_bytes,
+        .t = alloc_uniqtype};
+    struct bounds_cache_entry cached;
+    if (bounds_cache_lookup(obj, t, &alloc, &cached))
+    {
+        return __make_bounds((unsigned long)cached.base, (unsigned long)cached.limit);
+    }
+
     // SUBOBJ SEARCH
     struct uniqtype *cur_obj_uniqtype = alloc_uniqtype;
     struct uniqtype *cur_containing_uniqtype = NULL;
@@ -189,12 +591,19 @@ Bounds __fetch_bounds_internal(const void *obj, const void *derived, const struc
     struct bounds_cb_arg arg = {
         .passed_in_t = t,
         .target_offset = target_offset_within_uniqtype};
-    _Bool ret = __liballocs_search_subobjects_spanning(
-        alloc_uniqtype,
-        target_offset_within_uniqtype,
-        bounds_cb,
-        &arg,
-        NULL, NULL);
+    /* Use the flattened index when it can answer, else walk the subobjects */
+    if (!subobj_index_lookup(alloc_uniqtype, target_offset_within_uniqtype, &arg))
+    {
+        arg = (struct bounds_cb_arg) {
+            .passed_in_t = t,
+            .target_offset = target_offset_within_uniqtype};
+        _Bool ret = __liballocs_search_subobjects_spanning(
+            alloc_uniqtype,
+            target_offset_within_uniqtype,
+            bounds_cb,
+            &arg,
+            NULL, NULL);
+    }
     if (arg.success)
     {
         if (arg.innermost_containing_array_t)
@@ -205,9 +614,9 @@ Bounds __fetch_bounds_internal(const void *obj, const void *derived, const struc
                                     alloc_start + alloc_size_bytes
                                                                                              : (char *)alloc_start + arg.innermost_containing_array_type_span_start_offset + (UNIQTYPE_ARRAY_LENGTH(arg.innermost_containing_array_t) * t->pos_maxoff);
             unsigned period = UNIQTYPE_ARRAY_ELEMENT_TYPE(arg.innermost_containing_array_t)->pos_maxoff;
+            unsigned short depth = /* depth HACK FIXME */ arg.innermost_containing_array_type_span_start_offset == 0 ? 0 : 1;
             if (a && a->is_cacheable)
-                cache_bounds(lower, upper, period, 0, t,
-                             /* depth HACK FIXME */ arg.innermost_containing_array_type_span_start_offset == 0 ? 0 : 1);
+                bounds_cache_insert(&alloc, lower, upper, period, 0, t, depth);
             return __make_bounds(
                 (unsigned long)lower,
                 (unsigned long)upper);
@@ -215,9 +624,7 @@ Bounds __fetch_bounds_internal(const void *obj, const void *derived, const struc
         // bounds are just this object
         char *limit = (char *)obj + (t->pos_maxoff > 0 ? t->pos_maxoff : 1);
         if (a && a->is_cacheable)
-        {
-            cache_bounds(obj, limit, (t->pos_maxoff > 0 ? t->pos_maxoff : 1), 0, t, /* HACK FIXME depth */ 1);
-        }
+            bounds_cache_insert(&alloc, obj, limit, (t->pos_maxoff > 0 ? t->pos_maxoff : 1), 0, t, /* HACK FIXME depth */ 1);
         return __make_bounds((unsigned long)obj, (unsigned long)limit);
     }
     else
@@ -229,8 +636,6 @@ Bounds __fetch_bounds_internal(const void *obj, const void *derived, const struc
     }
 
 return_min_bounds:
-    if (a && a->is_cacheable)
-        cache_bounds(obj, (char *)obj + 1, 0, 0, NULL, 1);
     return __make_bounds((unsigned long)obj, (unsigned long)obj + 1);
 
 return_alloc_bounds:
@@ -246,12 +651,11 @@ return_alloc_bounds:
     // FIXME: the period here seems not right
     // -- if we are chars, should ignore alloc_uniqtype and go for 1?
     if (a && a->is_cacheable)
-        cache_bounds(base,
-                     limit,
-                     /* period */ alloc_uniqtype ? alloc_uniqtype->pos_maxoff : 1,
-                     /* offset to a t, i.e. to a char */ 0,
-                     t,
-                     /* HACK FIXME depth */ 0);
+        bounds_cache_insert(&alloc, base, limit,
+                /* period */ alloc_uniqtype ? alloc_uniqtype->pos_maxoff : 1,
+                /* offset to a t, i.e. to a char */ 0,
+                t,
+                /* HACK FIXME depth */ 0);
     return __make_bounds(
         (unsigned long)base,
         (unsigned long)limit);
@@ -259,22 +663,6 @@ return_alloc_bounds:
 
 out:
 abort_returning_max_bounds:
-    /* HACK: to avoid repeated slow-path queries for uninstrumented/unindexed
-     * allocations, we cache a range of bytes here.
-     * PROBLEM: if we currently need *bigger* bounds, we need some way to extend
-     * them, since we won't hit this path again. Otherwise we'll get bounds errors.
-     * Need to record that the bound are synthetic... use NULL alloc_base. */
-#define MIN(x, y) (((x) < (y)) ? (x) : (y))
-#define MAX(x, y) (((x) < (y)) ? (y) : (x))
-    cache_fake_bounds(
-        MIN((char *)obj, (char *)derived),
-        MAX((char *)obj, (char *)derived) + (t ? t->pos_maxoff : 0),
-        /* period */ (t ? t->pos_maxoff : 1),
-        0,
-        t,
-        0 /* depth */
-    );
-
     debug_println(1, "minicrunch: failed to fetch bounds for pointer %p (deriving %p); liballocs said %s (alloc site %p)",
                   obj, derived, err ? __liballocs_errstring(err) : "no allocation found spanning queried pointer", alloc_site);
     return __make_bounds((unsigned long) 0, (unsigned long) -1); // MAX_BOUNDS
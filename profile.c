@@ -0,0 +1,322 @@
+#include "foreign_library.h"
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+
+// The allocator hooks are shared by all interpreters. They are installed
+// while profiling is enabled in at least one of them.
+static pthread_mutex_t profile_hook_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned profile_nbenabled = 0;
+
+static const PyMemAllocatorDomain profile_domains[] = { PYMEM_DOMAIN_MEM, PYMEM_DOMAIN_OBJ };
+#define PROFILE_NB_DOMAINS (sizeof(profile_domains) / sizeof(profile_domains[0]))
+static PyMemAllocatorEx profile_orig_allocators[PROFILE_NB_DOMAINS];
+static bool profile_hooked = false;
+
+// Set while counting an allocation, as looking up the state of the
+// interpreter can itself allocate
+static _Thread_local bool profile_counting = false;
+
+// Count a block obtained from the Python memory and object allocators into
+// the state of the current interpreter (protected by its GIL)
+static void profile_countalloc(void)
+{
+    if (profile_counting) return;
+    profile_counting = true;
+    AllocsState *state = Allocs_GetState();
+    if (state) ++state->profile_nballocs;
+    profile_counting = false;
+}
+
+static void *profile_malloc(void *ctx, size_t size)
+{
+    PyMemAllocatorEx *alloc = ctx;
+    profile_countalloc();
+    return alloc->malloc(alloc->ctx, size);
+}
+
+static void *profile_calloc(void *ctx, size_t nelem, size_t elsize)
+{
+    PyMemAllocatorEx *alloc = ctx;
+    profile_countalloc();
+    return alloc->calloc(alloc->ctx, nelem, elsize);
+}
+
+static void *profile_realloc(void *ctx, void *ptr, size_t new_size)
+{
+    PyMemAllocatorEx *alloc = ctx;
+    if (!ptr) profile_countalloc();
+    return alloc->realloc(alloc->ctx, ptr, new_size);
+}
+
+static void profile_free(void *ctx, void *ptr)
+{
+    PyMemAllocatorEx *alloc = ctx;
+    alloc->free(alloc->ctx, ptr);
+}
+
+static void profile_hookallocators(void)
+{
+    if (profile_hooked) return;
+    for (unsigned i = 0; i < PROFILE_NB_DOMAINS; ++i)
+    {
+        PyMem_GetAllocator(profile_domains[i], &profile_orig_allocators[i]);
+        PyMemAllocatorEx hook = {
+            .ctx = &profile_orig_allocators[i],
+            .malloc = profile_malloc,
+            .calloc = profile_calloc,
+            .realloc = profile_realloc,
+            .free = profile_free,
+        };
+        PyMem_SetAllocator(profile_domains[i], &hook);
+    }
+    profile_hooked = true;
+}
+
+// Allocators hooked after ours (e.g. by tracemalloc) delegate to our hooks,
+// they are only removed if they are still on top
+static void profile_unhookallocators(void)
+{
+    if (!profile_hooked) return;
+    for (unsigned i = 0; i < PROFILE_NB_DOMAINS; ++i)
+    {
+        PyMemAllocatorEx current;
+        PyMem_GetAllocator(profile_domains[i], &current);
+        if (current.ctx != &profile_orig_allocators[i]) return;
+    }
+    for (unsigned i = 0; i < PROFILE_NB_DOMAINS; ++i)
+    {
+        PyMem_SetAllocator(profile_domains[i], &profile_orig_allocators[i]);
+    }
+    profile_hooked = false;
+}
+
+unsigned long long Profile_Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Checked once per foreign call, timestamps are only taken when set
+bool Profile_Enabled(void)
+{
+    AllocsState *state = Allocs_GetState();
+    return state && state->profile_enabled;
+}
+
+unsigned long long Profile_NbAllocs(void)
+{
+    return Allocs_GetState()->profile_nballocs;
+}
+
+static void profile_freeentry(PyObject *capsule)
+{
+    struct profile_entry *entry = PyCapsule_GetPointer(capsule, NULL);
+    Py_XDECREF(entry->pe_callable);
+    PyMem_Free(entry);
+}
+
+// Get the entry accumulating the calls to addr, creating it if needed.
+// callable is the Python object called by closures, and NULL for foreign
+// functions. Returns a new reference keeping *entry alive, or NULL with an
+// exception set.
+PyObject *Profile_GetEntry(void *addr, PyObject *callable, struct profile_entry **entry)
+{
+    PyObject *entries = Allocs_GetState()->profile_entries;
+    PyObject *key = PyLong_FromVoidPtr(addr);
+    if (!key) return NULL;
+
+    PyObject *capsule = PyDict_GetItemWithError(entries, key);
+    if (capsule)
+    {
+        Py_DECREF(key);
+        Py_INCREF(capsule);
+        *entry = PyCapsule_GetPointer(capsule, NULL);
+        return capsule;
+    }
+    if (PyErr_Occurred())
+    {
+        Py_DECREF(key);
+        return NULL;
+    }
+
+    *entry = PyMem_Calloc(1, sizeof(struct profile_entry));
+    if (!*entry)
+    {
+        Py_DECREF(key);
+        return PyErr_NoMemory();
+    }
+    (*entry)->pe_addr = addr;
+    Py_XINCREF(callable);
+    (*entry)->pe_callable = callable;
+
+    capsule = PyCapsule_New(*entry, NULL, profile_freeentry);
+    if (!capsule)
+    {
+        Py_XDECREF(callable);
+        PyMem_Free(*entry);
+    }
+    else if (PyDict_SetItem(entries, key, capsule) < 0) Py_CLEAR(capsule);
+    Py_DECREF(key);
+    return capsule;
+}
+
+PyObject *Profile_Set(int enable)
+{
+    AllocsState *state = Allocs_GetState();
+    PyObject *previous = PyBool_FromLong(state->profile_enabled);
+    if (enable < 0 || enable == state->profile_enabled) return previous;
+
+    pthread_mutex_lock(&profile_hook_lock);
+    if (enable && profile_nbenabled++ == 0) profile_hookallocators();
+    else if (!enable && --profile_nbenabled == 0) profile_unhookallocators();
+    pthread_mutex_unlock(&profile_hook_lock);
+    state->profile_enabled = enable;
+    return previous;
+}
+
+void Profile_Reset(void)
+{
+    PyDict_Clear(Allocs_GetState()->profile_entries);
+}
+
+static PyObject *profile_entryname(struct profile_entry *entry)
+{
+    if (entry->pe_callable) return PyUnicode_FromFormat("<closure %R>", entry->pe_callable);
+
+    Dl_info info;
+    if (dladdr(entry->pe_addr, &info) && info.dli_sname &&
+            info.dli_saddr == entry->pe_addr)
+    {
+        return PyUnicode_FromString(info.dli_sname);
+    }
+    return PyUnicode_FromFormat("<function at %p>", entry->pe_addr);
+}
+
+// List the calls profiled so far as dicts, sorted by the given field.
+// Names are sorted in ascending order, counters in descending order.
+PyObject *Profile_Stats(const char *sort_key)
+{
+    static const char *sort_keys[] = { "name", "calls", "marshal_ns", "call_ns",
+        "convert_ns", "py_allocations", NULL };
+    const char **valid_key = sort_keys;
+    while (*valid_key && strcmp(*valid_key, sort_key)) ++valid_key;
+    if (!*valid_key)
+    {
+        PyErr_Format(PyExc_ValueError, "Cannot sort profile statistics by '%s'", sort_key);
+        return NULL;
+    }
+
+    PyObject *entries = Allocs_GetState()->profile_entries;
+    PyObject *stats = PyList_New(0);
+    if (!stats) return NULL;
+
+    Py_ssize_t pos = 0;
+    PyObject *key, *capsule;
+    while (PyDict_Next(entries, &pos, &key, &capsule))
+    {
+        struct profile_entry *entry = PyCapsule_GetPointer(capsule, NULL);
+        PyObject *name = profile_entryname(entry);
+        PyObject *stat = name ? Py_BuildValue("{sNsOsKsKsKsKsK}",
+                "name", name,
+                "address", key,
+                "calls", entry->pe_calls,
+                "marshal_ns", entry->pe_marshal_ns,
+                "call_ns", entry->pe_call_ns,
+                "convert_ns", entry->pe_convert_ns,
+                "py_allocations", entry->pe_py_allocs) : NULL;
+        if (!stat || PyList_Append(stats, stat) < 0)
+        {
+            Py_XDECREF(stat);
+            Py_DECREF(stats);
+            return NULL;
+        }
+        Py_DECREF(stat);
+    }
+
+    PyObject *operator = PyImport_ImportModule("operator");
+    PyObject *itemgetter = operator ?
+        PyObject_CallMethod(operator, "itemgetter", "s", sort_key) : NULL;
+    Py_XDECREF(operator);
+    PyObject *sort = PyObject_GetAttrString(stats, "sort");
+    PyObject *sort_args = PyTuple_New(0);
+    PyObject *sort_kwds = itemgetter ? Py_BuildValue("{sOsO}", "key", itemgetter,
+            "reverse", strcmp(sort_key, "name") ? Py_True : Py_False) : NULL;
+    PyObject *ret = sort && sort_args && sort_kwds ?
+        PyObject_Call(sort, sort_args, sort_kwds) : NULL;
+    Py_XDECREF(itemgetter);
+    Py_XDECREF(sort);
+    Py_XDECREF(sort_args);
+    Py_XDECREF(sort_kwds);
+    if (!ret)
+    {
+        Py_DECREF(stats);
+        return NULL;
+    }
+    Py_DECREF(ret);
+    return stats;
+}
+
+static const char *query_names[NB_QUERIES] = {
+    [QUERY_GET_ALLOC_INFO] = "get_alloc_info",
+    [QUERY_GET_ALLOC_TYPE] = "get_alloc_type",
+    [QUERY_FETCH_BOUNDS] = "fetch_bounds",
+    [QUERY_ATTACH_POLICY] = "attach_lifetime_policy",
+    [QUERY_DETACH_POLICY] = "detach_lifetime_policy",
+};
+
+void Query_Record(enum allocs_query query, unsigned long long duration)
+{
+    AllocsState *state = Allocs_GetState();
+    if (!state) return;
+    struct query_stats *stats = &state->query_stats[query];
+    ++stats->qs_timed;
+    stats->qs_total_ns += duration;
+    if (duration > stats->qs_max_ns) stats->qs_max_ns = duration;
+
+    unsigned bucket = duration ? 64 - __builtin_clzll(duration) : 0;
+    if (bucket >= QUERY_NB_BUCKETS) bucket = QUERY_NB_BUCKETS - 1;
+    ++stats->qs_buckets[bucket];
+}
+
+// Get the counters of each query site as a dict. Histograms are lists of
+// (upper bound in ns, count) pairs, omitting empty buckets.
+PyObject *Query_GetStats(bool reset)
+{
+    struct query_stats *query_stats = Allocs_GetState()->query_stats;
+    PyObject *result = PyDict_New();
+    if (!result) return NULL;
+
+    for (unsigned q = 0; q < NB_QUERIES; ++q)
+    {
+        struct query_stats *stats = &query_stats[q];
+        PyObject *histogram = PyList_New(0);
+        for (unsigned i = 0; histogram && i < QUERY_NB_BUCKETS; ++i)
+        {
+            if (!stats->qs_buckets[i]) continue;
+            PyObject *bucket = i == QUERY_NB_BUCKETS - 1 ?
+                Py_BuildValue("(OK)", Py_None, stats->qs_buckets[i]) :
+                Py_BuildValue("(KK)", 1ull << i, stats->qs_buckets[i]);
+            if (!bucket || PyList_Append(histogram, bucket) < 0) Py_CLEAR(histogram);
+            Py_XDECREF(bucket);
+        }
+
+        PyObject *site = histogram ? Py_BuildValue("{sKsKsKsKsN}",
+                "count", stats->qs_count,
+                "timed", stats->qs_timed,
+                "total_ns", stats->qs_total_ns,
+                "max_ns", stats->qs_max_ns,
+                "histogram", histogram) : NULL;
+        if (!site || PyDict_SetItemString(result, query_names[q], site) < 0)
+        {
+            Py_XDECREF(site);
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_DECREF(site);
+    }
+
+    if (reset) memset(query_stats, 0, NB_QUERIES * sizeof(struct query_stats));
+    return result;
+}
@@ -1,14 +1,15 @@
 #include "foreign_library.h"
 
+// The proxy registries live in the per interpreter AllocsState:
+// - proxy_dict has weak references over values (using PyLong to store refs)
+// - proxy_pointing_addr_dict has strong refs over values
 // FIXME: Use more efficient representation than PyDict
-static PyObject *proxy_dict; // Weak reference over values (using PyLong to store refs)
-static PyObject *proxy_pointing_addr_dict; // Strong refs over values
 
 // Returns a borrowed reference
 static ProxyObject *proxy_for_addr(const void *addr)
 {
     PyObject *key = PyLong_FromVoidPtr((void *) addr);
-    PyObject *proxy_ptr = PyDict_GetItem(proxy_dict, key);
+    PyObject *proxy_ptr = PyDict_GetItem(Allocs_GetState()->proxy_dict, key);
     Py_DECREF(key);
     if (!proxy_ptr) return NULL;
     return PyLong_AsVoidPtr(proxy_ptr);
@@ -16,22 +17,34 @@ static ProxyObject *proxy_for_addr(const void *addr)
 
 void Proxy_AddRefTo(ProxyObject *target_proxy, const void **from)
 {
+    PyObject *pointing_dict = Allocs_GetState()->proxy_pointing_addr_dict;
     PyObject *from_key = PyLong_FromVoidPtr(from);
-    assert(!PyDict_Contains(proxy_pointing_addr_dict, from_key));
+    assert(!PyDict_Contains(pointing_dict, from_key));
     // This effectively incref target_proxy which is the desired behaviour
-    if(PyDict_SetItem(proxy_pointing_addr_dict, from_key, (PyObject *) target_proxy) < 0)
+    if(PyDict_SetItem(pointing_dict, from_key, (PyObject *) target_proxy) < 0)
         abort();
     Py_DECREF(from_key);
 }
 
 static void proxy_addref(const void *target, const void **from)
 {
+    // Foreign code can write pointers from an acall worker thread
+    struct python_entry entry;
+    AsyncCall_EnterPython(&entry);
+    // Interpreters that never imported allocs have no proxies
+    if (!Allocs_GetState())
+    {
+        AsyncCall_LeavePython(&entry);
+        return;
+    }
+
     ProxyObject *target_proxy = proxy_for_addr(target);
     // We should only be called if a proxy is registered for target
     assert(target_proxy);
     assert(target_proxy->p_ptr == target);
 
     Proxy_AddRefTo(target_proxy, from);
+    AsyncCall_LeavePython(&entry);
 }
 
 static void proxy_delref(const void *target, const void **from)
@@ -39,14 +52,22 @@ static void proxy_delref(const void *target, const void **from)
     /* We can ignore the target and just delete the entry in
      * proxy_pointing_addr_dict. */
 
+    struct python_entry entry;
+    AsyncCall_EnterPython(&entry);
+    AllocsState *state = Allocs_GetState();
+    if (!state)
+    {
+        AsyncCall_LeavePython(&entry);
+        return;
+    }
+    PyObject *pointing_dict = state->proxy_pointing_addr_dict;
     PyObject *from_key = PyLong_FromVoidPtr(from);
 
 #ifndef NDEBUG
     // Sanity check to be sure that we are effectively deleting what we think
-    if (target && PyDict_Contains(proxy_pointing_addr_dict, from_key) == 1)
+    if (target && PyDict_Contains(pointing_dict, from_key) == 1)
     {
-        ProxyObject *proxy =
-            (ProxyObject *) PyDict_GetItem(proxy_pointing_addr_dict, from_key);
+        ProxyObject *proxy = (ProxyObject *) PyDict_GetItem(pointing_dict, from_key);
         assert(proxy->p_ptr == target);
     }
 #endif
@@ -57,28 +78,35 @@ static void proxy_delref(const void *target, const void **from)
      * deletion. */
     PyObject *type, *value, *traceback;
     PyErr_Fetch(&type, &value, &traceback); // Save the current exception
-    if (PyDict_DelItem(proxy_pointing_addr_dict, from_key) < 0)
+    if (PyDict_DelItem(pointing_dict, from_key) < 0)
     {
         PyErr_Clear();
     }
     PyErr_Restore(type, value, traceback);
     Py_DECREF(from_key);
+    AsyncCall_LeavePython(&entry);
 }
 
 static int proxy_gc_policy_id = -1;
 
+// The lifetime policy is shared by all the interpreters of the process
 void Proxy_InitGCPolicy()
 {
-    proxy_dict = PyDict_New();
-    proxy_pointing_addr_dict = PyDict_New();
-    proxy_gc_policy_id = __liballocs_register_gc_policy(proxy_addref, proxy_delref);
+    if (proxy_gc_policy_id < 0)
+    {
+        proxy_gc_policy_id = __liballocs_register_gc_policy(proxy_addref, proxy_delref);
+    }
 }
 
 void Proxy_Register(ProxyObject *proxy)
 {
+    PyObject *proxy_dict = Allocs_GetState()->proxy_dict;
     PyObject *proxy_key = PyLong_FromVoidPtr(proxy->p_ptr);
     assert(!PyDict_Contains(proxy_dict, proxy_key));
 
+    // The address might have been used by a previous allocation
+    __minicrunch_bounds_cache_invalidate(proxy->p_ptr);
+
     // proxy_dict must only have a 'weak' reference
     // So use a PyLong for storing it instead of storing the object
     PyObject *proxy_ptr = PyLong_FromVoidPtr(proxy);
@@ -87,16 +115,83 @@ void Proxy_Register(ProxyObject *proxy)
     Py_DECREF(proxy_key);
 
     // Attach lifetime policy to the object to extend its lifetime
+    unsigned long long start = Query_Begin(QUERY_ATTACH_POLICY);
     __liballocs_attach_lifetime_policy(proxy_gc_policy_id, proxy->p_ptr);
+    Query_End(QUERY_ATTACH_POLICY, start);
 
     // Start tracking the object with the cycle GC
     if (PyType_IS_GC(Py_TYPE(proxy))) PyObject_GC_Track(proxy);
 }
 
+static int proxy_foreigngc(void *arg)
+{
+    AllocsState *state = Allocs_GetState();
+    if (!state || !PyGC_IsEnabled()) return 0;
+    ++state->foreign_gc_collections;
+    PyGC_Collect();
+    return 0;
+}
+
+// Must be called before allocating size bytes that will be owned by a proxy.
+// The cycle GC only counts Python objects, so a few proxies to large foreign
+// objects would not trigger it: schedule a collection every time
+// foreign_gc_threshold bytes have been allocated this way. The collection is
+// run as a pending call, so finalizers never run in the middle of a
+// conversion holding borrowed pointers or half-built proxies.
+void Proxy_ForeignAllocPressure(size_t size)
+{
+    AllocsState *state = Allocs_GetState();
+    state->foreign_pressure += size;
+    if (state->foreign_gc_threshold <= 0 ||
+            state->foreign_pressure < state->foreign_gc_threshold ||
+            !PyGC_IsEnabled())
+    {
+        return;
+    }
+
+    // If the pending calls are full, try again on the next allocation
+    if (Py_AddPendingCall(proxy_foreigngc, NULL) < 0) return;
+    state->foreign_pressure = 0;
+}
+
+// Register a base proxy for a malloc'ed chunk of size bytes that is freed
+// when the proxy dies. The chunk is reported to tracemalloc and counted in
+// the Python owned foreign memory.
+void Proxy_RegisterOwned(ProxyObject *proxy, size_t size)
+{
+    AllocsState *state = Allocs_GetState();
+    PyObject *key = PyLong_FromVoidPtr(proxy->p_ptr);
+    PyObject *size_obj = PyLong_FromSize_t(size);
+    if (key && size_obj && PyDict_SetItem(state->owned_allocs, key, size_obj) == 0)
+    {
+        state->owned_bytes += size;
+        PyTraceMalloc_Track(ALLOCS_TRACEMALLOC_DOMAIN, (uintptr_t) proxy->p_ptr, size);
+    }
+    else PyErr_Clear(); // Only statistics are lost
+    Py_XDECREF(key);
+    Py_XDECREF(size_obj);
+
+    Proxy_Register(proxy);
+    __liballocs_detach_manual_dealloc_policy(proxy->p_ptr);
+}
+
+// The chunk of a registered proxy is about to be freed
+static void proxy_releaseowned(PyObject *proxy_key)
+{
+    AllocsState *state = Allocs_GetState();
+    PyObject *size_obj = PyDict_GetItem(state->owned_allocs, proxy_key);
+    if (!size_obj) return;
+
+    state->owned_bytes -= PyLong_AsSsize_t(size_obj);
+    PyTraceMalloc_Untrack(ALLOCS_TRACEMALLOC_DOMAIN, PyLong_AsSize_t(proxy_key));
+    PyDict_DelItem(state->owned_allocs, proxy_key);
+}
+
 // Does nothing if obj has not been registered before
 // Call free on the underlying foreign object if we are the last lifetime policy
 void Proxy_Unregister(ProxyObject *proxy)
 {
+    PyObject *proxy_dict = Allocs_GetState()->proxy_dict;
     PyObject *proxy_key = PyLong_FromVoidPtr(proxy->p_ptr);
     PyObject *proxy_ptr = PyDict_GetItem(proxy_dict, proxy_key);
     if (proxy_ptr && PyLong_AsVoidPtr(proxy_ptr) == proxy)
@@ -104,8 +199,13 @@ void Proxy_Unregister(ProxyObject *proxy)
         // Stop tracking the object with the cycle GC
         if (PyType_IS_GC(Py_TYPE(proxy))) PyObject_GC_UnTrack(proxy);
 
+        proxy_releaseowned(proxy_key);
+
         // This calls free on the foreign object if necessary
+        unsigned long long start = Query_Begin(QUERY_DETACH_POLICY);
         __liballocs_detach_lifetime_policy(proxy_gc_policy_id, proxy->p_ptr);
+        Query_End(QUERY_DETACH_POLICY, start);
+        __minicrunch_bounds_cache_invalidate(proxy->p_ptr);
         PyDict_DelItem(proxy_dict, proxy_key);
     }
     Py_DECREF(proxy_key);
@@ -115,15 +215,17 @@ void Proxy_Unregister(ProxyObject *proxy)
 ProxyObject *Proxy_GetOrCreateBase(void *addr)
 {
     // Prevent recursion inside ourself
-    static bool creating_base = false;
-    if (creating_base) return NULL;
+    AllocsState *state = Allocs_GetState();
+    if (state->creating_base) return NULL;
 
     struct allocator *allocator;
     const void *alloc_start;
     struct uniqtype *alloc_type;
     struct liballocs_err* err;
+    unsigned long long start = Query_Begin(QUERY_GET_ALLOC_INFO);
     err = __liballocs_get_alloc_info(addr, &allocator, &alloc_start, NULL,
             &alloc_type, NULL);
+    Query_End(QUERY_GET_ALLOC_INFO, start);
     if (err || !ALLOCATOR_HANDLE_LIFETIME_INSERT(allocator) || !alloc_type)
     {
         return NULL;
@@ -144,9 +246,9 @@ ProxyObject *Proxy_GetOrCreateBase(void *addr)
         Py_DECREF(ftyp);
         return NULL;
     }
-    creating_base = true;
+    state->creating_base = true;
     proxy = (ProxyObject *) ftyp->ft_getfrom((void*) alloc_start, ftyp);
-    creating_base = false;
+    state->creating_base = false;
     Py_DECREF(ftyp);
     assert(proxy);
 
@@ -172,13 +274,15 @@ static int proxy_is_gc(ProxyObject *self)
 
     // We are GC iff we are a registered base proxy.
     PyObject *proxy_key = PyLong_FromVoidPtr(self->p_ptr);
-    PyObject *proxy_ptr = PyDict_GetItem(proxy_dict, proxy_key);
+    PyObject *proxy_ptr = PyDict_GetItem(Allocs_GetState()->proxy_dict, proxy_key);
     int res = proxy_ptr && PyLong_AsVoidPtr(proxy_ptr) == self;
     Py_DECREF(proxy_key);
     return res;
 }
 
 // TODO: Add Python GC management
+// Static, as the proxy types created by the metatypes are static types and
+// CPython does not allow them to derive from a heap type
 PyTypeObject Proxy_Type = {
     PyVarObject_HEAD_INIT(NULL, 0)
     .tp_name = "allocs.Proxy",
@@ -221,12 +325,13 @@ PyObject *Proxy_CopyFrom(void *data, ForeignTypeObject *type)
     ProxyObject *obj = PyObject_MaybeGC_New(ProxyObject, proxy_type);
     if (obj)
     {
-        obj->p_ptr = malloc(UNIQTYPE_SIZE_IN_BYTES(type->ft_type));
+        size_t size = UNIQTYPE_SIZE_IN_BYTES(type->ft_type);
+        Proxy_ForeignAllocPressure(size);
+        obj->p_ptr = malloc(size);
         __liballocs_set_alloc_type(obj->p_ptr, type->ft_type);
         // Should memcpy copy type information ?
-        memcpy(obj->p_ptr, data, UNIQTYPE_SIZE_IN_BYTES(type->ft_type));
-        Proxy_Register(obj);
-        __liballocs_detach_manual_dealloc_policy(obj->p_ptr);
+        memcpy(obj->p_ptr, data, size);
+        Proxy_RegisterOwned(obj, size);
     }
     return (PyObject *) obj;
 }
@@ -286,12 +391,100 @@ int Proxy_TraverseRef(void *data, visitproc visit, void *arg, ForeignTypeObject*
         proxy_delref(NULL, (const void **) data);
         return 0;
     }
-    PyObject *target_base_proxy = PyDict_GetItem(proxy_pointing_addr_dict, key);
+    PyObject *target_base_proxy = PyDict_GetItem(Allocs_GetState()->proxy_pointing_addr_dict, key);
     Py_DECREF(key);
     Py_VISIT(target_base_proxy);
     return 0;
 }
 
+// Build the value returned by __reduce_ex__ for a proxy whose buffer contents
+// can be copied into a new object of the given type with ft.from_buffer.
+// With protocol 5 the contents travel as an out-of-band PickleBuffer.
+PyObject *Proxy_ReduceEx(PyObject *obj, ForeignTypeObject *type, int protocol)
+{
+    if (ForeignType_ContainsPointers(type))
+    {
+        PyErr_Format(PyExc_TypeError,
+            "Cannot pickle foreign object of type '%s' containing pointers",
+            UNIQTYPE_NAME(type->ft_type));
+        return NULL;
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_FULL_RO) < 0) return NULL;
+
+    // Non contiguous views (e.g. stepped slices) are gathered into bytes
+    PyObject *payload;
+    if (protocol >= 5 && PyBuffer_IsContiguous(&view, 'C'))
+    {
+        payload = PyPickleBuffer_FromObject(obj);
+    }
+    else
+    {
+        payload = PyBytes_FromStringAndSize(NULL, view.len);
+        if (payload && PyBuffer_ToContiguous(PyBytes_AS_STRING(payload), &view, view.len, 'C') < 0)
+        {
+            Py_CLEAR(payload);
+        }
+    }
+    PyBuffer_Release(&view);
+    if (!payload) return NULL;
+
+    PyObject *rebuild = PyObject_GetAttrString((PyObject *) type, "from_buffer");
+    if (!rebuild)
+    {
+        Py_DECREF(payload);
+        return NULL;
+    }
+    return Py_BuildValue("N(N)", rebuild, payload);
+}
+
+// Number of foreign containers currently being repr'ed by the current thread.
+// Per thread, as the GIL can be released inside a nested repr.
+static _Thread_local Py_ssize_t proxy_repr_depth = 0;
+
+bool Proxy_ReprTooDeep(void)
+{
+    struct proxy_repr_limits *limits = &Allocs_GetState()->repr_limits;
+    return limits->max_depth >= 0 && proxy_repr_depth >= limits->max_depth;
+}
+
+// Check the limits before writing the index-th item of a foreign container.
+// Returns 1 and writes an ellipsis if the output must be truncated here,
+// 0 if the item can be written, and -1 on error.
+int Proxy_ReprTruncate(_PyUnicodeWriter *writer, Py_ssize_t index)
+{
+    struct proxy_repr_limits *limits = &Allocs_GetState()->repr_limits;
+    if ((limits->max_items < 0 || index < limits->max_items) &&
+        (limits->max_size < 0 || writer->pos < limits->max_size))
+    {
+        return 0;
+    }
+    const char *ellipsis = index ? ", ..." : "...";
+    if (_PyUnicodeWriter_WriteASCIIString(writer, ellipsis, -1) < 0) return -1;
+    return 1;
+}
+
+// Write the index-th item of a foreign container, preceded by a separator
+// and by "name: " if name is not NULL. Returns -1 on error.
+int Proxy_ReprItem(_PyUnicodeWriter *writer, Py_ssize_t index, const char *name, PyObject *item)
+{
+    if (index && _PyUnicodeWriter_WriteASCIIString(writer, ", ", 2) < 0) return -1;
+    if (name)
+    {
+        if (_PyUnicodeWriter_WriteASCIIString(writer, name, -1) < 0) return -1;
+        if (_PyUnicodeWriter_WriteASCIIString(writer, ": ", 2) < 0) return -1;
+    }
+
+    ++proxy_repr_depth;
+    PyObject *item_repr = PyObject_Repr(item);
+    --proxy_repr_depth;
+    if (!item_repr) return -1;
+    int ret = _PyUnicodeWriter_WriteStr(writer, item_repr);
+    Py_DECREF(item_repr);
+    return ret;
+}
+
 // Steals reference to proxytype
 ForeignTypeObject *Proxy_NewType(const struct uniqtype *type, PyTypeObject *proxytype)
 {
@@ -302,6 +495,7 @@ ForeignTypeObject *Proxy_NewType(const struct uniqtype *type, PyTypeObject *prox
     ftype->ft_getfrom = Proxy_GetFrom;
     ftype->ft_copyfrom = Proxy_CopyFrom;
     ftype->ft_storeinto = Proxy_StoreInto;
+    ftype->ft_storemany = NULL;
     ftype->ft_getdataptr = Proxy_GetDataPtr;
     ftype->ft_traverse = NULL;
     return ftype;
@@ -26,12 +26,13 @@ if DEBUG:
 
 allocs = Extension('allocs',
                    include_dirs = INCLUDE_PATHS,
-                   libraries = ['dl', 'ffi', 'allocs'],
+                   libraries = ['dl', 'ffi', 'allocs', 'pthread'],
                    library_dirs = LIBRARY_PATHS,
                    sources = ['allocs_module.c', 'library_loader.c',
                        'proxy.c', 'foreign_type.c', 'foreign_basetype.c',
                        'function_proxy.c', 'composite_proxy.c',
-                       'address_proxy.c'],
+                       'address_proxy.c', 'minicrunch.c', 'async_call.c',
+                       'profile.c'],
                    extra_compile_args = compile_args,
                    undef_macros = ["NDEBUG"] if DEBUG else [])
 
@@ -0,0 +1,33 @@
+import ctypes
+import allocs
+
+def address(arr):
+    return ctypes.addressof(ctypes.c_char.from_buffer(memoryview(arr).cast("B")))
+
+# Arrays built from a length are zeroed at allocation
+big = allocs.double.array(1 << 20)
+assert big[0] == 0 and big[-1] == 0
+big[12345] = 1.5
+assert big[12345] == 1.5
+
+for align in (64, 4096):
+    arr = allocs.int.array(1000, align=align)
+    assert address(arr) % align == 0
+    assert list(arr[:3]) == [0, 0, 0]
+
+arr = allocs.int.array([1, 2, 3], align=128)
+assert address(arr) % 128 == 0
+assert list(arr) == [1, 2, 3]
+
+# Huge page arrays are not aligned unless asked, so that they stay lazily zeroed
+huge = allocs.char.array(4 << 20, huge_pages=True)
+assert memoryview(huge[:4]).tobytes() == b"\0\0\0\0"
+huge = allocs.char.array(4 << 20, huge_pages=True, align=2 << 20)
+assert address(huge) % (2 << 20) == 0
+assert memoryview(huge[-4:]).tobytes() == b"\0\0\0\0"
+
+try:
+    allocs.int.array(10, align=24)
+    exit(1)
+except ValueError:
+    pass
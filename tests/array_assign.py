@@ -0,0 +1,58 @@
+import array
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import basic as b
+from elflib import arrays as a
+
+arr = b.uint_16.array([1, 2, 3, 4, 5, 6])
+arr[1:3] = [20, 30]
+assert list(arr) == [1, 20, 30, 4, 5, 6]
+arr[::2] = (7, 8, 9)
+assert list(arr) == [7, 20, 8, 4, 9, 6]
+arr[-2:] = array.array('H', [10, 11])
+assert list(arr) == [7, 20, 8, 4, 10, 11]
+
+# Copies between foreign arrays handle overlapping memory
+arr[:] = arr[::-1]
+assert list(arr) == [11, 10, 4, 8, 20, 7]
+arr[1:] = arr[:-1]
+assert list(arr) == [11, 11, 10, 4, 8, 20]
+
+# Sizes must match
+try:
+    arr[:2] = [1, 2, 3]
+    assert False
+except ValueError:
+    pass
+
+# Array fields can be assigned as a whole
+m = a.make_matrix()
+m.cells = [[5, 4, 3], [2, 1, 0]]
+assert memoryview(m.cells).tolist() == [[5, 4, 3], [2, 1, 0]]
+m2 = a.make_matrix()
+m2.cells = m.cells
+assert memoryview(m2.cells).tolist() == [[5, 4, 3], [2, 1, 0]]
+m.cells[1][::2] = [7, 7]
+assert list(m.cells[1]) == [7, 1, 7]
+
+na = a.make_named_array(2)
+na[0].first_name = "Frodo"
+na[1].first_name = na[0].first_name
+assert bytes(memoryview(na[1].first_name)).rstrip(b"\0") == b"Frodo"
+
+# Pointers converted from Python are resolved before being written
+x = allocs.int.array([1, 2])
+y = allocs.int.array([3])
+ptrs = allocs.int.ptr.array([x, None, y])
+assert ptrs[0][1] == 2 and ptrs[1] is None and ptrs[2][0] == 3
+ptrs[:2] = [y, x]
+assert ptrs[0][0] == 3 and ptrs[1][1] == 2
+try:
+    ptrs[:] = [x, 42, y]
+    assert False
+except TypeError:
+    pass
+assert ptrs[0][0] == 3 and ptrs[2][0] == 3
+strs = allocs.char.ptr.array(["ab", b"cd"])
+assert strs[0] is not None and strs[1] is not None
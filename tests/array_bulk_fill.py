@@ -0,0 +1,51 @@
+import array
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import basic as b
+
+# Exact ints and floats go through the bulk converters
+int_arr = allocs.int.array([1, -2, 3, 0, 0])
+assert list(int_arr) == [1, -2, 3, 0, 0]
+dbl_arr = allocs.double.array([0.5, 1, 2.5])
+assert list(dbl_arr) == [0.5, 1.0, 2.5]
+
+# Range errors are still reported
+try:
+    b.uint_16.array([1, 2, 70000])
+    assert False
+except OverflowError:
+    pass
+try:
+    b.uint_16.array([1, -1])
+    assert False
+except OverflowError:
+    pass
+
+# Out of range values are never written to foreign memory
+arr = b.uint_16.array([0, 0, 0])
+try:
+    arr[:] = [1, 70000, 5]
+    assert False
+except OverflowError:
+    pass
+assert arr[1] == 0
+try:
+    arr[:] = [1, -1, 5]
+    assert False
+except OverflowError:
+    pass
+assert arr[1] == 0
+
+# Int subclasses fall back to per item conversion
+class MyInt(int):
+    pass
+assert list(allocs.int.array([MyInt(7), 8])) == [7, 8]
+
+# Buffers with the same representation are copied directly
+src = array.array('i', range(4))
+assert list(allocs.int.array(src)) == [0, 1, 2, 3]
+assert list(allocs.double.array(array.array("d", [1.5, 2.5]))) == [1.5, 2.5]
+
+# Other buffers are converted item by item
+assert list(allocs.double.array(array.array('i', [1, 2]))) == [1.0, 2.0]
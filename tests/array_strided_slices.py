@@ -0,0 +1,32 @@
+import elflib
+elflib.__path__.append("libs/")
+from elflib import basic as m
+
+char = m.signed_char_8
+
+int_arr = m.uint_16.array([1,2,3,4,5,6])
+evens = int_arr[::2]
+print(evens)
+print(int_arr[::-1])
+print(int_arr[4::-2])
+print(evens[1:])
+print(evens[::-1])
+print(list(evens))
+
+# Empty slices stay inside the array and can be sliced again
+empty = int_arr[-100:-200:-1]
+assert len(empty) == 0 and list(empty[::-1]) == []
+assert len(int_arr[6::-1][6:]) == 0
+
+# Strided views share the memory of the original array
+evens[1] = 42
+print(int_arr)
+del int_arr
+print(evens)
+
+view = memoryview(evens)
+print(view.strides, view.tolist())
+
+char_arr = char.array("hello world")
+print(char_arr[::2])
+print(char_arr[::-1])
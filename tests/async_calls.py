@@ -0,0 +1,50 @@
+import asyncio
+import gc
+import time
+import weakref
+import elflib
+elflib.__path__.append("libs/")
+from elflib import basic as b
+from elflib import closures
+
+async def main():
+    assert await b.triple.acall(14) == 42
+
+    # Calls completing together are gathered in the same batch
+    results = await asyncio.gather(*(b.triple.acall(i) for i in range(100)))
+    assert results == [3 * i for i in range(100)]
+
+    # Closures called back from a worker thread take the GIL
+    add_one = elflib.int.fun(elflib.int)(lambda x: x + 1)
+    assert await closures.fold_int.acall(5, add_one) == closures.fold_int(5, add_one)
+
+    try:
+        await b.triple.acall()
+        exit(1)
+    except TypeError:
+        pass
+
+asyncio.run(main())
+
+# The queue of a loop closed with calls still running is dropped, and does
+# not keep the loop alive once the calls finish
+def slow(x):
+    time.sleep(0.05)
+    return x
+slow_fn = elflib.int.fun(elflib.int)(slow)
+
+async def start():
+    return closures.fold_int.acall(2, slow_fn)
+
+loop = asyncio.new_event_loop()
+pending = loop.run_until_complete(start())
+loop.close()
+loop_ref = weakref.ref(loop)
+del loop, pending
+
+async def other():
+    assert await b.triple.acall(1) == 3
+asyncio.run(other())
+time.sleep(0.5)
+gc.collect()
+assert loop_ref() is None
@@ -0,0 +1,30 @@
+# Benchmark filling foreign arrays from Python sequences and buffers
+import array
+import timeit
+import allocs
+
+NB_ELEMS = 10**6
+REPEAT = 5
+
+class Int(int):
+    pass
+
+ints = list(range(NB_ELEMS))
+subclass_ints = [Int(i) for i in ints]
+int_buf = array.array('i', ints)
+floats = [float(i) for i in ints]
+float_buf = array.array('d', floats)
+
+def fill_per_item():
+    arr = allocs.int.array(NB_ELEMS)
+    for i, v in enumerate(ints):
+        arr[i] = v
+
+for label, fn in (("int: per item assignment", fill_per_item),
+                  ("int: int subclass list", lambda: allocs.int.array(subclass_ints)),
+                  ("int: list", lambda: allocs.int.array(ints)),
+                  ("int: array.array", lambda: allocs.int.array(int_buf)),
+                  ("double: list", lambda: allocs.double.array(floats)),
+                  ("double: array.array", lambda: allocs.double.array(float_buf))):
+    t = min(timeit.repeat(fn, number=1, repeat=REPEAT))
+    print("%-28s %8.3f ms" % (label, t * 1000))
@@ -0,0 +1,167 @@
+# Microbenchmarks of the FFI hot paths, with ctypes baselines when possible.
+# Run from the tests directory: ./python bench/hotpaths.py [--output FILE]
+# Results are printed as JSON, times are in nanoseconds per operation.
+import argparse
+import ctypes
+import gc
+import json
+import platform
+import statistics
+import sys
+import timeit
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import bench as b
+
+parser = argparse.ArgumentParser()
+parser.add_argument("--repeat", type=int, default=7)
+parser.add_argument("--min-time", type=float, default=0.05,
+                    help="Minimum duration of one timed run, in seconds")
+parser.add_argument("--filter", default="", help="Only run benchmarks containing this string")
+parser.add_argument("--output", help="Write the JSON results to this file")
+args = parser.parse_args()
+
+c = ctypes.CDLL("libs/bench.so")
+
+class CPoint(ctypes.Structure):
+    _fields_ = [("x", ctypes.c_int), ("y", ctypes.c_int), ("weight", ctypes.c_double)]
+
+class CNode(ctypes.Structure):
+    pass
+CNode._fields_ = [("next", ctypes.POINTER(CNode)), ("value", ctypes.c_int)]
+
+c.bench_add.argtypes = [ctypes.c_int, ctypes.c_int]
+c.bench_add.restype = ctypes.c_int
+c.bench_scale.argtypes = [ctypes.c_double, ctypes.c_double]
+c.bench_scale.restype = ctypes.c_double
+c.bench_norm1.argtypes = [ctypes.POINTER(CPoint)]
+c.bench_norm1.restype = ctypes.c_int
+c.bench_make_point.argtypes = [ctypes.c_int, ctypes.c_int]
+c.bench_make_point.restype = CPoint
+c.bench_sum.argtypes = [ctypes.POINTER(ctypes.c_int), ctypes.c_int]
+c.bench_sum.restype = ctypes.c_long
+CALLBACK = ctypes.CFUNCTYPE(ctypes.c_int, ctypes.c_int)
+c.bench_apply.argtypes = [ctypes.c_int, CALLBACK]
+c.bench_apply.restype = ctypes.c_int
+c.bench_make_list.argtypes = [ctypes.c_int]
+c.bench_make_list.restype = ctypes.POINTER(CNode)
+
+NB_ITEMS = 1000
+NB_NODES = 1000
+NB_CALLBACKS = 100
+
+point = b.bench_point(3, -4, 1.0)
+cpoint = CPoint(3, -4, 1.0)
+arr = allocs.int.array(list(range(NB_ITEMS)))
+carr = (ctypes.c_int * NB_ITEMS)(*range(NB_ITEMS))
+add_one = allocs.int.fun(allocs.int)(lambda x: x + 1)
+cadd_one = CALLBACK(lambda x: x + 1)
+nodes = b.bench_make_list(NB_NODES)
+cnodes = c.bench_make_list(NB_NODES)
+
+def read_fields():
+    return point.x + point.y
+
+def cread_fields():
+    return cpoint.x + cpoint.y
+
+def write_field():
+    point.weight = 2.0
+
+def cwrite_field():
+    cpoint.weight = 2.0
+
+def index_array():
+    for i in range(NB_ITEMS):
+        arr[i]
+
+def cindex_array():
+    for i in range(NB_ITEMS):
+        carr[i]
+
+def walk_list():
+    node = nodes
+    while node is not None:
+        node = node.next
+
+def cwalk_list():
+    node = cnodes
+    while node:
+        node = node.contents.next
+
+def collect_with_proxies():
+    # Keep one proxy per node alive while the cycle GC runs
+    live = []
+    node = nodes
+    while node is not None:
+        live.append(node)
+        node = node.next
+    gc.collect()
+
+def ccollect_with_proxies():
+    live = []
+    node = cnodes
+    while node:
+        live.append(node)
+        node = node.contents.next
+    gc.collect()
+
+# (name, number of operations per call, allocs version, ctypes version)
+BENCHMARKS = [
+    ("call: void()", 1, lambda: b.bench_noop(), lambda: c.bench_noop()),
+    ("call: int(int, int)", 1, lambda: b.bench_add(1, 2), lambda: c.bench_add(1, 2)),
+    ("call: double(double, double)", 1, lambda: b.bench_scale(1.5, 2.0),
+        lambda: c.bench_scale(1.5, 2.0)),
+    ("call: int(struct *)", 1, lambda: b.bench_norm1(point),
+        lambda: c.bench_norm1(ctypes.byref(cpoint))),
+    ("call: struct(int, int)", 1, lambda: b.bench_make_point(1, 2),
+        lambda: c.bench_make_point(1, 2)),
+    ("call: long(int *, int)", 1, lambda: b.bench_sum(arr, NB_ITEMS),
+        lambda: c.bench_sum(carr, NB_ITEMS)),
+    ("field: read 2 ints", 1, read_fields, cread_fields),
+    ("field: write double", 1, write_field, cwrite_field),
+    ("array: index", NB_ITEMS, index_array, cindex_array),
+    ("array: to list", NB_ITEMS, lambda: list(arr), lambda: list(carr)),
+    ("proxy: struct construction", 1, lambda: b.bench_point(1, 2, 3.0),
+        lambda: CPoint(1, 2, 3.0)),
+    ("proxy: array construction", NB_ITEMS, lambda: allocs.int.array(NB_ITEMS),
+        lambda: (ctypes.c_int * NB_ITEMS)()),
+    ("proxy: pointer chasing", NB_NODES, walk_list, cwalk_list),
+    ("closure: callback", NB_CALLBACKS, lambda: b.bench_apply(NB_CALLBACKS, add_one),
+        lambda: c.bench_apply(NB_CALLBACKS, cadd_one)),
+    ("gc: collect with live proxies", 1, collect_with_proxies, ccollect_with_proxies),
+]
+
+def measure(fn, nb_ops):
+    fn() # Warm up caches and lazily created types
+    timer = timeit.Timer(fn)
+    number, _ = timer.autorange()
+    number = max(1, int(number * args.min_time / 0.2))
+    runs = [t / number / nb_ops * 1e9 for t in timer.repeat(args.repeat, number)]
+    return {"min": min(runs), "median": statistics.median(runs), "runs": args.repeat,
+            "number": number}
+
+results = []
+for name, nb_ops, allocs_fn, ctypes_fn in BENCHMARKS:
+    if args.filter not in name:
+        continue
+    result = {"name": name, "ops": nb_ops, "allocs": measure(allocs_fn, nb_ops)}
+    if ctypes_fn:
+        result["ctypes"] = measure(ctypes_fn, nb_ops)
+        result["ratio"] = result["allocs"]["min"] / result["ctypes"]["min"]
+    results.append(result)
+    print("%-32s %10.1f ns" % (name, result["allocs"]["min"]), file=sys.stderr)
+
+report = {
+    "python": platform.python_version(),
+    "machine": platform.machine(),
+    "unit": "ns/op",
+    "benchmarks": results,
+}
+if args.output:
+    with open(args.output, "w") as f:
+        json.dump(report, f, indent=2)
+else:
+    json.dump(report, sys.stdout, indent=2)
+    print()
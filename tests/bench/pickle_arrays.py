@@ -0,0 +1,29 @@
+# Benchmark pickling of large foreign arrays, in-band and out-of-band
+import pickle
+import timeit
+import elflib
+elflib.__path__.append("libs/")
+from elflib import arrays as a
+
+NB_ELEMS = 10**6
+NB_STRUCTS = 10**5
+REPEAT = 5
+
+int_arr = a.int.array(range(NB_ELEMS))
+named_arr = a.named.array(NB_STRUCTS)
+
+def roundtrip_inband(obj, proto):
+    return pickle.loads(pickle.dumps(obj, protocol=proto))
+
+def roundtrip_outofband(obj):
+    buffers = []
+    data = pickle.dumps(obj, protocol=5, buffer_callback=buffers.append)
+    return pickle.loads(data, buffers=buffers)
+
+for name, obj in (("int[%d]" % NB_ELEMS, int_arr),
+                  ("struct named[%d]" % NB_STRUCTS, named_arr)):
+    for label, fn in (("protocol 4", lambda: roundtrip_inband(obj, 4)),
+                      ("protocol 5 in-band", lambda: roundtrip_inband(obj, 5)),
+                      ("protocol 5 out-of-band", lambda: roundtrip_outofband(obj))):
+        t = min(timeit.repeat(fn, number=1, repeat=REPEAT))
+        print("%-20s %-24s %8.3f ms" % (name, label, t * 1000))
@@ -0,0 +1,37 @@
+import allocs
+import gc
+import elflib
+elflib.__path__.append("libs/")
+from elflib import arrays as m
+
+m.open_struct.bind_length("elems", "nb_elems")
+
+arr = m.named.array(3)
+for i, name in enumerate(["ada", "bob", "eve"]):
+    arr[i].first_name = name
+s = m.make_full(3, arr)
+
+# The length is read from nb_elems instead of the allocation bounds
+stats = allocs._length_stats()
+assert len(s.elems) == 3
+assert bytes(s.elems[2].first_name).rstrip(b"\0") == b"eve"
+s.nb_elems = 2
+assert len(s.elems) == 2
+assert [bytes(e.first_name).rstrip(b"\0") for e in s.elems] == [b"ada", b"bob"]
+assert allocs._length_stats() == stats
+
+assert len(m.make_empty().elems) == 0
+
+# Counts larger than the array are clamped to its bounds, also when the
+# collector traverses the structure
+s.nb_elems = 1000
+assert len(s.elems) < 1000
+assert [bytes(e.first_name).rstrip(b"\0") for e in s.elems[:3]] == [b"ada", b"bob", b"eve"]
+gc.collect()
+
+for field, length_field in [("nb_elems", "nb_elems"), ("elems", "elems"), ("elems", "missing")]:
+    try:
+        m.open_struct.bind_length(field, length_field)
+        exit(1)
+    except (TypeError, AttributeError):
+        pass
@@ -0,0 +1,19 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import arrays as m
+
+arr = m.make_int_array(8)
+stats = allocs._bounds_cache_stats()
+
+# Every element of the array shares the same cached bounds
+for i in range(1, 8):
+    assert len(m.get_index(arr, i)) == 1
+new_stats = allocs._bounds_cache_stats()
+assert new_stats["hits"] + new_stats["misses"] == stats["hits"] + stats["misses"] + 7
+assert new_stats["hits"] > stats["hits"]
+
+# After a flush, the next query goes through liballocs again
+allocs._flush_bounds_cache()
+assert len(m.get_index(arr, 1)) == 1
+assert allocs._bounds_cache_stats()["misses"] == new_stats["misses"] + 1
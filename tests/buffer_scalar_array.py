@@ -0,0 +1,28 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import basic as b
+from elflib import arrays as a
+
+int_arr = b.uint_16.array([1, 2, 3, 4, 5])
+view = memoryview(int_arr)
+assert view.format == "H" and view.itemsize == 2
+assert view.tolist() == [1, 2, 3, 4, 5]
+
+# Writes go directly to foreign memory
+view[0] = 42
+assert int_arr[0] == 42
+
+dbl_arr = allocs.double.array([0.5, 1.5, 2.5])
+assert memoryview(dbl_arr).tolist() == [0.5, 1.5, 2.5]
+
+# Arrays of arrays get a proper shape
+mat = a.make_matrix()
+view = memoryview(mat.cells)
+assert view.shape == (2, 3)
+assert view.strides == (12, 4)
+assert view.tolist() == [[0, 1, 2], [3, 4, 5]]
+
+# The view holds the foreign memory alive
+del mat
+assert view[1, 2] == 5
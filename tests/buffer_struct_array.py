@@ -0,0 +1,19 @@
+import elflib
+elflib.__path__.append("libs/")
+from elflib import arrays as m
+
+arr = m.named.array(3)
+view = memoryview(arr)
+assert view.format == "T{=(20)c:first_name:(20)c:last_name:}"
+assert view.itemsize == 40
+assert view.shape == (3,)
+assert view.nbytes == 120
+
+# Writes through the buffer are visible in the foreign array (no copy)
+raw = view.cast('B')
+raw[40:43] = b"Bob"
+assert b"".join(arr[1].first_name[:3]) == b"Bob"
+
+# The view keeps the array alive
+del arr, raw
+assert view.tobytes()[40:43] == b"Bob"
@@ -0,0 +1,42 @@
+import asyncio
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import basic as b
+
+length = allocs.ByRef()
+assert b.parse_int("1234abc", length) == 1234
+assert length.value == 4
+assert b.parse_int("", length) == 0
+assert length.value == 0
+
+lo, hi = allocs.ByRef(), allocs.ByRef(0.0)
+b.minmax(2.5, -1.0, lo, hi)
+assert (lo.value, hi.value) == (-1.0, 2.5)
+
+# Arrays are still accepted for the same parameters
+arr = allocs.int.array(1)
+b.parse_int("12", arr)
+assert arr[0] == 2
+
+# Out-parameters need no heap allocation
+allocs.query_stats(reset=True)
+blocks = allocs.foreign_memory()["blocks"]
+for _ in range(10):
+    b.parse_int("42", length)
+assert allocs.query_stats()["attach_lifetime_policy"]["count"] == 0
+assert allocs.foreign_memory()["blocks"] == blocks
+
+try:
+    b.minmax(1.0, 2.0, allocs.ByRef("foo"), hi)
+    exit(1)
+except TypeError:
+    pass
+assert hi.value == 2.5
+
+async def main():
+    out = allocs.ByRef()
+    assert await b.parse_int.acall("987", out) == 987
+    assert out.value == 3
+
+asyncio.run(main())
@@ -0,0 +1,44 @@
+import gc
+import tracemalloc
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import bigrecursive
+
+BR_SIZE = 8 + 0x1000
+
+start = allocs.foreign_memory()
+br = bigrecursive.bigrecursive()
+arr = allocs.double.array(1000)
+mem = allocs.foreign_memory()
+assert mem["bytes"] - start["bytes"] == BR_SIZE + 8000
+assert mem["blocks"] - start["blocks"] == 2
+
+# Memory is given back when the proxies die
+del br, arr
+assert allocs.foreign_memory()["bytes"] == start["bytes"]
+
+# Foreign chunks show up in tracemalloc snapshots, in their own domain
+tracemalloc.start()
+br = bigrecursive.bigrecursive()
+domain_filter = tracemalloc.DomainFilter(True, allocs.TRACEMALLOC_DOMAIN)
+traces = tracemalloc.take_snapshot().filter_traces([domain_filter]).traces
+assert sum(t.size for t in traces) == BR_SIZE
+del br
+traces = tracemalloc.take_snapshot().filter_traces([domain_filter]).traces
+assert len(traces) == 0
+tracemalloc.stop()
+
+# Unreachable cycles are collected once enough foreign memory is allocated,
+# even if they hold few Python objects. The collection is deferred to the
+# next pending calls check, which the loop reaches before allocating again.
+previous = allocs.foreign_gc_threshold(100 * BR_SIZE)
+gc.set_threshold(10**6)
+forced = allocs.foreign_memory()["gc_collections"]
+for _ in range(1000):
+    br = bigrecursive.bigrecursive()
+    br.ptr = br
+del br
+assert allocs.foreign_memory()["gc_collections"] - forced >= 9
+assert allocs.foreign_memory()["bytes"] - start["bytes"] <= 101 * BR_SIZE
+assert allocs.foreign_gc_threshold(previous) == 100 * BR_SIZE
@@ -0,0 +1,19 @@
+import gc
+import allocs
+
+x = allocs.int.array([1, 2])
+ptrs = allocs.int.ptr.array([x, x, x])
+holder = allocs.int.ptr.ptr.array([ptrs])
+
+# Collections do not query the bounds of decoded pointers
+decoded = [holder[0] for _ in range(100)]
+allocs.query_stats(reset=True)
+gc.collect()
+gc.collect()
+assert allocs.query_stats()["fetch_bounds"]["count"] == 0
+
+# The length is still available when used
+assert decoded[0][2][1] == 2
+del decoded
+gc.collect()
+assert list(x) == [1, 2]
@@ -0,0 +1,19 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import arrays as m
+
+arr = m.make_int_array(4)
+stats = allocs._length_stats()
+
+# Decoding a pointer does not query its bounds
+ptr = m.get_index(arr, 2)
+new_stats = allocs._length_stats()
+assert new_stats["deferred"] == stats["deferred"] + 1
+assert new_stats["computed"] == stats["computed"]
+
+# The length is computed once, on first use
+assert len(ptr) == 1
+assert len(ptr) == 1
+ptr[0] = 5
+assert allocs._length_stats()["computed"] == stats["computed"] + 1
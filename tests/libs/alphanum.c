@@ -13,3 +13,17 @@ int *get_digits()
 {
     return &DIGITS;
 }
+
+unsigned long NB_CALLS = 0;
+
+void count_call()
+{
+    ++NB_CALLS;
+}
+
+unsigned long get_nb_calls()
+{
+    return NB_CALLS;
+}
+
+const int NB_VOWELS = 6;
@@ -43,3 +43,20 @@ struct open_struct *make_full(int nb_elems, struct named arr[])
     return s;
 }
 
+
+struct matrix
+{
+    int nb_rows;
+    int cells[2][3];
+};
+
+struct matrix *make_matrix()
+{
+    struct matrix *m = malloc(sizeof(struct matrix));
+    m->nb_rows = 2;
+    for (int i = 0; i < 2; ++i)
+    {
+        for (int j = 0; j < 3; ++j) m->cells[i][j] = 3*i + j;
+    }
+    return m;
+}
@@ -20,3 +20,18 @@ long double mul(double a, double b)
     return a*b;
 }
 
+
+int parse_int(const char *s, int *out_len)
+{
+    int value = 0;
+    int len = 0;
+    while (s[len] >= '0' && s[len] <= '9') value = 10 * value + (s[len++] - '0');
+    *out_len = len;
+    return value;
+}
+
+void minmax(double a, double b, double *min, double *max)
+{
+    *min = a < b ? a : b;
+    *max = a < b ? b : a;
+}
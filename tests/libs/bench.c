@@ -0,0 +1,69 @@
+#include <stdlib.h>
+
+// Small functions exercising the hot paths of the FFI, used by
+// bench/hotpaths.py
+
+struct bench_point
+{
+    int x;
+    int y;
+    double weight;
+};
+
+struct bench_node
+{
+    struct bench_node *next;
+    int value;
+};
+
+void bench_noop()
+{
+}
+
+int bench_add(int a, int b)
+{
+    return a + b;
+}
+
+double bench_scale(double value, double factor)
+{
+    return value * factor;
+}
+
+int bench_norm1(struct bench_point *p)
+{
+    return abs(p->x) + abs(p->y);
+}
+
+struct bench_point bench_make_point(int x, int y)
+{
+    struct bench_point p = { x, y, 1.0 };
+    return p;
+}
+
+long bench_sum(int *arr, int nb_elems)
+{
+    long sum = 0;
+    for (int i = 0; i < nb_elems; ++i) sum += arr[i];
+    return sum;
+}
+
+int bench_apply(int times, int (*fun)(int))
+{
+    int acc = 0;
+    while (times--) acc = fun(acc);
+    return acc;
+}
+
+struct bench_node *bench_make_list(int nb_nodes)
+{
+    struct bench_node *head = NULL;
+    while (nb_nodes--)
+    {
+        struct bench_node *node = malloc(sizeof(struct bench_node));
+        node->next = head;
+        node->value = nb_nodes;
+        head = node;
+    }
+    return head;
+}
@@ -0,0 +1,31 @@
+import elflib
+elflib.__path__.append("libs/")
+from elflib import alphanum as m
+
+assert m.NB_LETTERS == 26
+
+# Reads see updates made by C code
+assert m.NB_CALLS == 0
+m.count_call()
+m.count_call()
+assert m.NB_CALLS == 2
+
+# Writes reach C code
+m.NB_CALLS = 40
+m.count_call()
+assert m.get_nb_calls() == 41
+
+try:
+    del m.NB_CALLS
+    exit(1)
+except AttributeError:
+    pass
+
+# Constants live in read-only memory and cannot be assigned
+assert m.NB_VOWELS == 6
+try:
+    m.NB_VOWELS = 5
+    exit(1)
+except AttributeError:
+    pass
+assert m.NB_VOWELS == 6
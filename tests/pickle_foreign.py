@@ -0,0 +1,50 @@
+import pickle
+import elflib
+elflib.__path__.append("libs/")
+from elflib import composite as m
+from elflib import arrays as a
+from elflib import basic as b
+from elflib import bintree
+
+hw = m.hello_world(42, 2.5)
+for proto in range(pickle.HIGHEST_PROTOCOL + 1):
+    hw_copy = pickle.loads(pickle.dumps(hw, protocol=proto))
+    assert hw_copy.hello == 42 and hw_copy.world == 2.5
+
+# Out-of-band buffers with protocol 5
+int_arr = b.uint_16.array([1, 2, 3, 4, 5])
+buffers = []
+data = pickle.dumps(int_arr, protocol=5, buffer_callback=buffers.append)
+assert len(buffers) == 1
+int_arr_copy = pickle.loads(data, buffers=buffers)
+assert list(int_arr_copy) == [1, 2, 3, 4, 5]
+int_arr_copy[0] = 10
+assert int_arr[0] == 1
+
+# Strided views are gathered into a new contiguous array
+for proto in (4, 5):
+    assert list(pickle.loads(pickle.dumps(int_arr[::-2], protocol=proto))) == [5, 3, 1]
+
+named_arr = a.named.array(3)
+named_copy = pickle.loads(pickle.dumps(named_arr, protocol=5))
+assert len(named_copy) == 3
+assert bytes(memoryview(named_copy)) == bytes(memoryview(named_arr))
+
+# Pointers cannot be pickled
+bt = bintree.bintree(1)
+try:
+    pickle.dumps(bt)
+    exit(1)
+except TypeError:
+    pass
+
+# Structures with pointers only export read-only buffers
+view = memoryview(bt)
+assert view.readonly and view.nbytes == len(bytes(view))
+try:
+    view[0] = 0
+    exit(1)
+except TypeError:
+    pass
+hw_view = memoryview(m.hello_world(1, 2))
+assert not hw_view.readonly
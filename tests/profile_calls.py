@@ -0,0 +1,46 @@
+import allocs
+import asyncio
+import elflib
+elflib.__path__.append("libs/")
+from elflib import basic as b
+from elflib import closures
+
+add_one = elflib.int.fun(elflib.int)(lambda x: x + 1)
+
+# Nothing is recorded until profiling is enabled
+b.triple(1)
+assert allocs.profile_stats() == []
+
+assert allocs.profile(True) == False
+for i in range(10):
+    assert b.triple(i) == 3 * i
+assert closures.fold_int(5, add_one) == 5
+# Calls run on worker threads are recorded once they complete
+assert asyncio.run(b.triple.acall(7)) == 21
+assert allocs.profile(False) == True
+b.triple(1)
+
+stats = {s["name"]: s for s in allocs.profile_stats()}
+assert stats["triple"]["calls"] == 11
+assert stats["fold_int"]["calls"] == 1
+closure_stats = [s for s in stats.values() if s["name"].startswith("<closure")]
+assert len(closure_stats) == 1 and closure_stats[0]["calls"] == 5
+for s in stats.values():
+    assert s["marshal_ns"] >= 0 and s["call_ns"] > 0 and s["convert_ns"] >= 0
+    assert s["py_allocations"] >= 0
+
+# The time spent in the callbacks is part of the foreign call
+assert stats["fold_int"]["call_ns"] >= closure_stats[0]["call_ns"]
+
+names = [s["name"] for s in allocs.profile_stats()]
+assert names == sorted(names)
+calls = [s["calls"] for s in allocs.profile_stats(sort="calls")]
+assert calls == sorted(calls, reverse=True)
+try:
+    allocs.profile_stats(sort="nope")
+    exit(1)
+except ValueError:
+    pass
+
+allocs.profile_reset()
+assert allocs.profile_stats() == []
@@ -0,0 +1,33 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import arrays as m
+from elflib import composite as c
+
+arr = m.make_int_array(6)
+for i in range(len(arr)):
+    arr[i] = i
+
+# Results are cached by Python type, but still depend on the object when
+# needed (strided views of the same type are never accepted)
+rejected = [arr[::2], c.hello_world(), allocs.double.array(3), 42, "str"]
+for _ in range(3):
+    assert m.get_index(arr, 2)[0] == 2
+    assert m.get_index(arr[1:], 2)[0] == 3
+    for obj in rejected:
+        try:
+            m.get_index(obj, 0)
+            exit(1)
+        except TypeError:
+            pass
+
+# Each pointer type has its own cache
+hw = c.hello_world(1, 2.0)
+c.save_hw(hw)
+for _ in range(3):
+    try:
+        c.save_hw(arr)
+        exit(1)
+    except TypeError:
+        pass
+    assert c.swap_saved_hw(hw).hello == 1
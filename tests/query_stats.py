@@ -0,0 +1,29 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import composite as m
+
+allocs.query_stats(reset=True)
+a = m.hello_world(1, 1)
+del a
+stats = allocs.query_stats()
+assert stats["attach_lifetime_policy"]["count"] >= 1
+assert stats["detach_lifetime_policy"]["count"] >= 1
+# Latencies are only measured while profiling
+assert stats["attach_lifetime_policy"]["timed"] == 0
+assert stats["attach_lifetime_policy"]["histogram"] == []
+
+allocs.query_stats(reset=True)
+allocs.profile(True)
+for i in range(100):
+    a = m.hello_world(i, i)
+allocs.profile(False)
+stats = allocs.query_stats(reset=True)["attach_lifetime_policy"]
+assert stats["count"] == stats["timed"] == 100
+assert sum(count for _, count in stats["histogram"]) == 100
+assert stats["max_ns"] <= stats["total_ns"]
+bounds = [bound for bound, _ in stats["histogram"] if bound is not None]
+assert bounds == sorted(bounds)
+assert stats["max_ns"] < bounds[-1] or stats["histogram"][-1][0] is None
+
+assert allocs.query_stats()["attach_lifetime_policy"]["count"] == 0
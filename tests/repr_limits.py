@@ -0,0 +1,20 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import basic as b
+from elflib import nested_struct as m
+
+big = b.uint_16.array(1000000)
+assert len(repr(big)) < 2000
+
+defaults = allocs.repr_limits(items=5, depth=1, size=10)
+print(b.uint_16.array([1, 2, 3, 4, 5, 6, 7]))
+print(b.signed_char_8.array("abcdefghijklmnop"))
+# Truncation does not split the UTF-8 encoding of "é"
+print(b.signed_char_8.array([*b"abcdefghi", -0x3d, -0x57]))
+
+o = m.outstruct()
+print(o)
+
+allocs.repr_limits(**defaults)
+print(o)
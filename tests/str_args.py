@@ -0,0 +1,17 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import print as m
+
+m.print_str("hello")
+m.print_str(b"raw bytes")
+m.print_str("héllo wörld")
+m.print_str(allocs.char.array("foreign"))
+
+# C code would only see the start of strings with embedded nulls
+for s in ("a\0b", b"a\0b"):
+    try:
+        m.print_str(s)
+        assert False
+    except ValueError:
+        pass
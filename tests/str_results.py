@@ -0,0 +1,32 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import alphanum as m
+
+alphabet = "abcdefghijklmnopqrstuvwxyz"
+
+s = m.get_alphabet()
+assert bytes(s) == alphabet.encode()
+assert s.decode() == alphabet
+assert bytes(s.cstring) == alphabet.encode()
+
+# Reading the string does not change the length of the pointer
+assert len(s) == len(m.get_alphabet())
+
+# Arrays are read as C strings too, the whole buffer is in their memory view
+arr = allocs.char.array(b"abc\0def")
+assert bytes(arr) == b"abc"
+assert arr.decode("ascii") == "abc"
+assert bytes(arr.cstring) == b"abc"
+assert memoryview(arr).tobytes() == b"abc\0def"
+assert arr[4:].decode("ascii") == "def"
+
+get_str = m.get_alphabet.str_result()
+assert get_str() == alphabet
+
+for strided in (lambda: arr[::2].cstring, lambda: arr[::2].decode()):
+    try:
+        strided()
+        exit(1)
+    except TypeError:
+        pass
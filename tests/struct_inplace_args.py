@@ -0,0 +1,32 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import composite as m
+from elflib import nested_struct as n
+
+class Hw:
+    def __init__(self, h, w):
+        self.hello = h
+        self.world = w
+
+m.print_hw((1, 2)) # Creates the types involved
+
+# Converting pointer free structs passed by value needs no proxy
+allocs.query_stats(reset=True)
+blocks = allocs.foreign_memory()["blocks"]
+m.print_hw((49, 3))
+m.print_hw({'hello': 0, 'world': 2.71828})
+m.print_hw(Hw(42, 9.99))
+assert allocs.query_stats()["attach_lifetime_policy"]["count"] == 0
+assert allocs.foreign_memory()["blocks"] == blocks
+
+# Failed conversions do not modify the destination
+o = n.outstruct((1, 2), (3, 4))
+try:
+    o.b = (5, "foo")
+    exit(1)
+except TypeError:
+    pass
+assert (o.b.data1, o.b.data2) == (3, 4)
+o.b = {'data2': 6}
+assert (o.a.data1, o.a.data2, o.b.data1, o.b.data2) == (1, 2, 0, 6)
@@ -0,0 +1,11 @@
+import allocs
+import elflib
+elflib.__path__.append("libs/")
+from elflib import arrays as a
+from elflib import nested_struct as n
+
+# Nested structs, arrays of arrays and arrays of structs
+for t in (n.outstruct, a.matrix, a.named):
+    res = allocs._check_subobject_index(t)
+    assert res["checked"] > 0, t
+    assert res["mismatches"] == 0, (t, res)